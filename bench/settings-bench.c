@@ -0,0 +1,71 @@
+/* Evoution Tray plugin
+ *  Copyright (C) 2025 George Katevenis <george_kate@hotmail.com>
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Per-event cost of reading a setting from a window event handler: a fresh
+ * GSettings object per query (is_part_enabled()), vs. the settings cache
+ * (tray_settings). Meant to be run through 'meson test --benchmark', which
+ * points GSettings to the schema compiled in the build dir, and to the
+ * memory backend. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gio/gio.h>
+#include <glib/gprintf.h>
+
+#include "properties.h"
+
+#define N_EVENTS_UNCACHED 20000
+#define N_EVENTS_CACHED 10000000
+
+static volatile gboolean sink;
+
+int main(int argc, char *argv[]) {
+	gint64 start, end;
+	
+	start = g_get_monotonic_time();
+	
+	for(gint i = 0; i < N_EVENTS_UNCACHED; i++)
+		sink = is_part_enabled(TRAY_SCHEMA, CONF_KEY_HIDE_ON_MINIMIZE);
+	
+	end = g_get_monotonic_time();
+	
+	gdouble uncached_ns = (end - start) * 1000.0 / N_EVENTS_UNCACHED;
+	
+	if(properties_init(NULL) != 0) {
+		g_printerr("settings-bench: properties_init() failed\n");
+		return 1;
+	}
+	
+	start = g_get_monotonic_time();
+	
+	for(gint i = 0; i < N_EVENTS_CACHED; i++)
+		sink = tray_settings.hide_on_minimize;
+	
+	end = g_get_monotonic_time();
+	
+	gdouble cached_ns = (end - start) * 1000.0 / N_EVENTS_CACHED;
+	
+	properties_fini();
+	
+	g_printf("is_part_enabled(): %10.1f ns/event\n", uncached_ns);
+	g_printf("tray_settings:     %10.1f ns/event\n", cached_ns);
+	
+	return 0;
+}
@@ -0,0 +1,473 @@
+/* Evoution Tray plugin
+ *  Copyright (C) 2025 George Katevenis <george_kate@hotmail.com>
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* The D-Bus side of sn.c, without a desktop panel. A private bus is started
+ * with GTestDBus, and a mock StatusNotifierWatcher on a connection of its
+ * own plays both the watcher and the host: it accepts registrations, and
+ * fetches the item's properties like a host would -- everything with
+ * GetAll on registration, and the affected properties on every change
+ * signal. Measured:
+ *
+ * - registration: from sn_init() to RegisterStatusNotifierItem reaching the
+ *   watcher. The first one is with a cold bus connection.
+ * - watcher restart: from the watcher re-acquiring its name, to the item
+ *   registering again (through on_snw_owner_changed()).
+ * - Activate round-trip, as seen by the host.
+ * - icon changes: from sn_set_icon()/sn_set_counts() until the host has
+ *   re-fetched everything it was told about. Also the number of signals and
+ *   property Gets per change, both per single change, and for a burst of
+ *   changes within one update interval (which should coalesce).
+ *
+ * The signal/Get counts are the interesting part for regressions; more
+ * chatter means more wakeups for every host on the desktop. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+
+#include <gio/gio.h>
+#include <glib/gprintf.h>
+
+#include "sn.h"
+#include "tray.h"
+
+// Give up on any single step after this long (ms)
+#define STEP_TIMEOUT 10000
+
+static const gchar watcher_xml[] =
+"<node>"
+"  <interface name='" SNW_INTERFACE "'>"
+"	<method name='RegisterStatusNotifierItem'>"
+"	  <arg type='s' name='service' direction='in'/>"
+"	</method>"
+"  </interface>"
+"</node>";
+
+static gint iterations = 20;
+static gint burst = 100;
+static gint burst_interval = 100;
+static gboolean json = FALSE;
+
+static GOptionEntry options[] = {
+	{"iterations", 'n', 0, G_OPTION_ARG_INT, &iterations,
+		"Repetitions of each measurement", "N"},
+	{"burst", 'b', 0, G_OPTION_ARG_INT, &burst,
+		"Number of changes in the coalescing burst", "N"},
+	{"burst-interval", 'i', 0, G_OPTION_ARG_INT, &burst_interval,
+		"Update interval (ms) during the burst", "MS"},
+	{"json", 'j', 0, G_OPTION_ARG_NONE, &json,
+		"Output results as JSON", NULL},
+	{NULL}
+};
+
+static GDBusConnection *watcher = NULL;
+static guint watcher_owner_id = 0;
+
+// What the mock watcher/host has seen
+static guint n_registered = 0;
+static guint n_signals = 0;
+static guint n_gets = 0;
+static guint n_pending = 0;
+static guint n_activated = 0;
+
+static guint64 registered_at = 0;
+static gboolean step_timed_out = FALSE;
+
+// -----------------------------
+
+// Stand-ins for the rest of the plugin
+action_enum_t tray_action(action_enum_t requested_action) {
+	return ACTION_SHOW;
+}
+
+// What Activate calls
+void tray_activate(action_enum_t requested_action) {
+	n_activated++;
+	tray_action(requested_action);
+}
+
+void quit_evolution(void) {}
+void properties_show(void) {}
+
+// -----------------------------
+
+static inline guint64 now_ns(void) {
+	return g_get_monotonic_time() * 1000;
+}
+
+static gint cmp_u64(gconstpointer a, gconstpointer b) {
+	guint64 x = *(const guint64 *) a, y = *(const guint64 *) b;
+	return (x > y) - (x < y);
+}
+
+static gboolean on_step_timeout(gpointer data) {
+	step_timed_out = TRUE;
+	return G_SOURCE_REMOVE;
+}
+
+// Iterate the main loop until cond holds, or bail out if it never does
+#define RUN_UNTIL(cond) G_STMT_START { \
+	step_timed_out = FALSE; \
+	guint timeout_id = g_timeout_add(STEP_TIMEOUT, on_step_timeout, NULL); \
+	\
+	while(!(cond) && !step_timed_out) \
+		g_main_context_iteration(NULL, TRUE); \
+	\
+	if(step_timed_out) { \
+		g_printerr("sn-bench: timed out waiting on the item\n"); \
+		exit(1); \
+	} \
+	\
+	g_source_remove(timeout_id); \
+} G_STMT_END
+
+static void run_for(guint ms) {
+	step_timed_out = FALSE;
+	g_timeout_add(ms, on_step_timeout, NULL);
+	
+	while(!step_timed_out)
+		g_main_context_iteration(NULL, TRUE);
+}
+
+// -----------------------------
+
+static void on_call_done(GObject *source, GAsyncResult *res, gpointer data) {
+	GError *error = NULL;
+	GVariant *reply = g_dbus_connection_call_finish(
+		G_DBUS_CONNECTION(source), res, &error);
+	
+	if(!reply) {
+		g_printerr("sn-bench: call failed: %s\n", error->message);
+		exit(1);
+	}
+	
+	g_variant_unref(reply);
+	n_pending--;
+}
+
+static void call_item(const gchar *iface, const gchar *method, GVariant *params) {
+	n_pending++;
+	
+	g_dbus_connection_call(watcher, DBUS_SERVICE_NAME, SNI_OBJECT_PATH,
+		iface, method, params, NULL, G_DBUS_CALL_FLAGS_NONE,
+		SN_DBUS_TIMEOUT, NULL, on_call_done, NULL);
+}
+
+static void host_get(const gchar *name) {
+	n_gets++;
+	
+	call_item("org.freedesktop.DBus.Properties", "Get",
+		g_variant_new("(ss)", SNI_INTERFACE, name));
+}
+
+/* Wait for the host to be done with everything the item has sent so far.
+ * Messages from one connection arrive in order, so when the Ping returns,
+ * all earlier signals have been seen, and the Gets they triggered are
+ * pending too. */
+static void drain(void) {
+	call_item("org.freedesktop.DBus.Peer", "Ping", NULL);
+	RUN_UNTIL(n_pending == 0);
+}
+
+static void wait_registered(void) {
+	guint target = n_registered + 1;
+	RUN_UNTIL(n_registered >= target);
+}
+
+static void on_item_signal(GDBusConnection *conn, const gchar *sender,
+	const gchar *path, const gchar *interface, const gchar *signal_name,
+	GVariant *params, gpointer data)
+{
+	n_signals++;
+	
+	if(g_strcmp0(signal_name, "NewIcon") == 0) {
+		host_get("IconName");
+		host_get("IconPixmap");
+	} else if(g_strcmp0(signal_name, "NewTitle") == 0)
+		host_get("Title");
+	else if(g_strcmp0(signal_name, "NewToolTip") == 0)
+		host_get("ToolTip");
+}
+
+static void on_watcher_method_call(GDBusConnection *conn, const gchar *sender,
+	const gchar *object_path, const gchar *iface, const gchar *method_name,
+	GVariant *params, GDBusMethodInvocation *inv, gpointer data)
+{
+	registered_at = now_ns();
+	n_registered++;
+	
+	g_dbus_method_invocation_return_value(inv, NULL);
+	
+	// Like a host picking up a new item
+	n_gets++;
+	call_item("org.freedesktop.DBus.Properties", "GetAll",
+		g_variant_new("(s)", SNI_INTERFACE));
+}
+
+static void watcher_own(void) {
+	watcher_owner_id = g_bus_own_name_on_connection(watcher, SNW_BUS_NAME,
+		G_BUS_NAME_OWNER_FLAGS_NONE, NULL, NULL, NULL, NULL);
+}
+
+static void watcher_init(const gchar *address) {
+	GError *error = NULL;
+	
+	watcher = g_dbus_connection_new_for_address_sync(address,
+		G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT
+		| G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+		NULL, NULL, &error);
+	
+	if(!watcher) {
+		g_printerr("sn-bench: can't connect to the test bus: %s\n", error->message);
+		exit(1);
+	}
+	
+	GDBusNodeInfo *info = g_dbus_node_info_new_for_xml(watcher_xml, NULL);
+	
+	static const GDBusInterfaceVTable vtable = {
+		.method_call = on_watcher_method_call,
+	};
+	
+	g_dbus_connection_register_object(watcher, SNW_OBJECT_PATH,
+		g_dbus_node_info_lookup_interface(info, SNW_INTERFACE),
+		&vtable, NULL, NULL, NULL);
+	
+	g_dbus_node_info_unref(info);
+	
+	g_dbus_connection_signal_subscribe(watcher, DBUS_SERVICE_NAME,
+		SNI_INTERFACE, NULL, SNI_OBJECT_PATH, NULL,
+		G_DBUS_SIGNAL_FLAGS_NONE, on_item_signal, NULL, NULL);
+	
+	watcher_own();
+}
+
+// -----------------------------
+
+typedef struct bench_result_t {
+	guint64 *ns;
+	gint n;
+} bench_result_t;
+
+static void result_sort(bench_result_t *r) {
+	qsort(r->ns, r->n, sizeof(*r->ns), cmp_u64);
+}
+
+static guint64 measure_cold_registration(void) {
+	guint64 start = now_ns();
+	
+	sn_init(ICON_READ);
+	wait_registered();
+	guint64 ns = registered_at - start;
+	
+	drain();
+	sn_fini();
+	
+	return ns;
+}
+
+static void measure_registration(bench_result_t *r) {
+	for(gint i = 0; i < r->n; i++) {
+		guint64 start = now_ns();
+		
+		sn_init(ICON_READ);
+		wait_registered();
+		r->ns[i] = registered_at - start;
+		
+		drain();
+		sn_fini();
+	}
+	
+	result_sort(r);
+}
+
+static void measure_restart(bench_result_t *r) {
+	for(gint i = 0; i < r->n; i++) {
+		g_bus_unown_name(watcher_owner_id);
+		
+		guint64 start = now_ns();
+		
+		watcher_own();
+		wait_registered();
+		r->ns[i] = registered_at - start;
+		
+		drain();
+	}
+	
+	result_sort(r);
+}
+
+static void measure_activate(bench_result_t *r) {
+	for(gint i = 0; i < r->n; i++) {
+		guint64 start = now_ns();
+		
+		call_item(SNI_INTERFACE, "Activate", g_variant_new("(ii)", 0, 0));
+		RUN_UNTIL(n_pending == 0);
+		
+		r->ns[i] = now_ns() - start;
+	}
+	
+	result_sort(r);
+}
+
+static void make_change(gint i) {
+	sn_set_icon(i % 2 ? ICON_UNREAD : ICON_READ);
+	sn_set_counts(i + 1, (i + 1) % 3, NULL, NULL);
+}
+
+static void measure_changes(bench_result_t *r, guint *signals, guint *gets) {
+	sn_set_update_interval(0);
+	
+	guint signals_before = n_signals, gets_before = n_gets;
+	
+	for(gint i = 0; i < r->n; i++) {
+		guint64 start = now_ns();
+		
+		make_change(i);
+		drain();
+		
+		r->ns[i] = now_ns() - start;
+	}
+	
+	*signals = n_signals - signals_before;
+	*gets = n_gets - gets_before;
+	
+	result_sort(r);
+}
+
+// All of the burst lands within a single update interval
+static void measure_burst(guint *signals, guint *gets) {
+	sn_set_update_interval(burst_interval);
+	
+	guint signals_before = n_signals, gets_before = n_gets;
+	
+	for(gint i = 0; i < burst; i++)
+		make_change(i);
+	
+	run_for(burst_interval * 2);
+	drain();
+	
+	*signals = n_signals - signals_before;
+	*gets = n_gets - gets_before;
+	
+	sn_set_update_interval(SN_DEFAULT_UPDATE_INTERVAL);
+}
+
+int main(int argc, char *argv[]) {
+	GOptionContext *ctx = g_option_context_new("- StatusNotifierItem D-Bus benchmark");
+	GError *error = NULL;
+	
+	g_option_context_add_main_entries(ctx, options, NULL);
+	
+	if(!g_option_context_parse(ctx, &argc, &argv, &error)) {
+		g_printerr("sn-bench: %s\n", error->message);
+		return 1;
+	}
+	
+	g_option_context_free(ctx);
+	
+	if(iterations <= 0 || burst <= 0 || burst_interval <= 0) {
+		g_printerr("sn-bench: iterations, burst and burst-interval must be > 0\n");
+		return 1;
+	}
+	
+	// Also points the session bus (so, sn.c) to it
+	GTestDBus *test_bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+	g_test_dbus_up(test_bus);
+	
+	watcher_init(g_test_dbus_get_bus_address(test_bus));
+	
+	bench_result_t reg = {g_new(guint64, iterations), iterations};
+	bench_result_t restart = {g_new(guint64, iterations), iterations};
+	bench_result_t activate = {g_new(guint64, iterations), iterations};
+	bench_result_t change = {g_new(guint64, iterations), iterations};
+	guint change_signals, change_gets, burst_signals, burst_gets;
+	
+	guint64 cold_ns = measure_cold_registration();
+	measure_registration(&reg);
+	
+	// The rest with the item up
+	sn_init(ICON_READ);
+	wait_registered();
+	drain();
+	
+	measure_restart(&restart);
+	measure_activate(&activate);
+	measure_changes(&change, &change_signals, &change_gets);
+	measure_burst(&burst_signals, &burst_gets);
+	
+	sn_fini();
+	
+	if(n_activated != (guint) iterations) {
+		g_printerr("sn-bench: %u of %d Activate calls reached the plugin\n",
+			n_activated, iterations);
+		return 1;
+	}
+	
+	#define PCT(r, p) ((r)->ns[(gsize) (((r)->n - 1) * (p))] / 1000.0)
+	
+	gdouble signals_per_change = (gdouble) change_signals / iterations;
+	gdouble gets_per_change = (gdouble) change_gets / iterations;
+	
+	if(json) {
+		g_printf("{\"iterations\": %d, \"cold_register_us\": %.1f, "
+			"\"register_us\": {\"p50\": %.1f, \"max\": %.1f}, "
+			"\"watcher_restart_us\": {\"p50\": %.1f, \"max\": %.1f}, "
+			"\"activate_us\": {\"p50\": %.1f, \"max\": %.1f}, "
+			"\"change_us\": {\"p50\": %.1f, \"max\": %.1f}, "
+			"\"signals_per_change\": %.2f, \"gets_per_change\": %.2f, "
+			"\"burst\": %d, \"burst_interval_ms\": %d, "
+			"\"burst_signals\": %u, \"burst_gets\": %u}\n",
+			iterations, cold_ns / 1000.0,
+			PCT(&reg, 0.5), PCT(&reg, 1),
+			PCT(&restart, 0.5), PCT(&restart, 1),
+			PCT(&activate, 0.5), PCT(&activate, 1),
+			PCT(&change, 0.5), PCT(&change, 1),
+			signals_per_change, gets_per_change,
+			burst, burst_interval, burst_signals, burst_gets);
+	} else {
+		g_printf("iterations: %d\n", iterations);
+		g_printf("register:        cold %.1f us, then p50 %.1f us, max %.1f us\n",
+			cold_ns / 1000.0, PCT(&reg, 0.5), PCT(&reg, 1));
+		g_printf("watcher restart: p50 %.1f us, max %.1f us\n",
+			PCT(&restart, 0.5), PCT(&restart, 1));
+		g_printf("activate:        p50 %.1f us, max %.1f us\n",
+			PCT(&activate, 0.5), PCT(&activate, 1));
+		g_printf("icon change:     p50 %.1f us, max %.1f us, "
+			"%.2f signals, %.2f gets per change\n",
+			PCT(&change, 0.5), PCT(&change, 1),
+			signals_per_change, gets_per_change);
+		g_printf("burst of %d in %d ms: %u signals, %u gets\n",
+			burst, burst_interval, burst_signals, burst_gets);
+	}
+	
+	#undef PCT
+	
+	g_free(reg.ns);
+	g_free(restart.ns);
+	g_free(activate.ns);
+	g_free(change.ns);
+	
+	g_clear_object(&watcher);
+	
+	g_test_dbus_down(test_bus);
+	g_object_unref(test_bus);
+	
+	return 0;
+}
@@ -0,0 +1,319 @@
+/* Evoution Tray plugin
+ *  Copyright (C) 2025 George Katevenis <george_kate@hotmail.com>
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Replays a trace recorded with EVOLUTION_TRAY_TRACE (see src/trace.h)
+ * through ucount, as fast as possible, ignoring the recorded timing.
+ *
+ * Besides the throughput, it reports the read/unread status transitions
+ * that the tray would have gone through (same logic as in tray.c), and
+ * the final status. So a trace doubles as a regression fixture: replaying
+ * it must keep yielding the same transitions. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <time.h>
+
+#include <gio/gio.h>
+#include <glib/gprintf.h>
+
+#include "ucount.h"
+#include "trace.h"
+
+typedef struct replay_rec_t {
+	guint8 type;
+	guint32 folder;
+	guint32 count;
+	guint32 new_folder;
+	
+	// For TRACE_REC_UIDS
+	GPtrArray *added;
+	GPtrArray *gone;
+} replay_rec_t;
+
+static gint loops = 1;
+static gboolean json = FALSE;
+
+static GOptionEntry options[] = {
+	{"loops", 'l', 0, G_OPTION_ARG_INT, &loops,
+		"Replay the trace N times (on a fresh table each time)", "N"},
+	{"json", 'j', 0, G_OPTION_ARG_NONE, &json,
+		"Output results as JSON", NULL},
+	{NULL}
+};
+
+static gboolean unread = FALSE;
+static guint n_to_unread = 0;
+static guint n_to_read = 0;
+
+static void on_checkpoint(void) {
+	if(unread) {
+		unread = FALSE;
+		n_to_read++;
+	}
+}
+
+static inline guint64 now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (guint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static gboolean get_varint(const guchar **p, const guchar *end, guint64 *v) {
+	guint shift = 0;
+	*v = 0;
+	
+	while(*p < end && shift < 64) {
+		guchar b = *(*p)++;
+		*v |= (guint64) (b & 0x7f) << shift;
+		
+		if(!(b & 0x80))
+			return TRUE;
+		
+		shift += 7;
+	}
+	
+	return FALSE;
+}
+
+static void clear_rec(gpointer data) {
+	replay_rec_t *rec = data;
+	
+	g_clear_pointer(&rec->added, g_ptr_array_unref);
+	g_clear_pointer(&rec->gone, g_ptr_array_unref);
+}
+
+static GPtrArray *get_uids(const guchar **p, const guchar *end) {
+	guint64 n, len;
+	
+	if(!get_varint(p, end, &n) || n > (gsize) (end - *p))
+		return NULL;
+	
+	GPtrArray *uids = g_ptr_array_new_full(n, g_free);
+	
+	for(guint64 i = 0; i < n; i++) {
+		if(!get_varint(p, end, &len) || len > (gsize) (end - *p)) {
+			g_ptr_array_unref(uids);
+			return NULL;
+		}
+		
+		g_ptr_array_add(uids, g_strndup((const gchar *) *p, len));
+		*p += len;
+	}
+	
+	return uids;
+}
+
+static gboolean parse_trace(const guchar *data, gsize len,
+	GPtrArray *folders, GArray *records)
+{
+	const guchar *p = data, *end = data + len;
+	guint64 dt, id, new_id, count, flen;
+	
+	if(len < 5 || memcmp(p, TRACE_MAGIC, 4) != 0
+			|| p[4] < 1 || p[4] > TRACE_VERSION)
+		return FALSE;
+	
+	p += 5;
+	
+	while(p < end) {
+		guchar tag = *p++;
+		
+		switch(tag) {
+			case TRACE_REC_FOLDER:
+				if(!get_varint(&p, end, &id) || !get_varint(&p, end, &flen)
+					|| id != folders->len || flen > (gsize) (end - p))
+					return FALSE;
+				
+				g_ptr_array_add(folders, g_strndup((const gchar *) p, flen));
+				p += flen;
+				break;
+			
+			case TRACE_REC_EVENT:
+				if(!get_varint(&p, end, &dt) || !get_varint(&p, end, &id)
+					|| !get_varint(&p, end, &count) || id >= folders->len)
+					return FALSE;
+				
+				g_array_append_val(records, ((replay_rec_t) {
+					.type = tag, .folder = id, .count = count}));
+				break;
+			
+			case TRACE_REC_CHECKPOINT:
+				if(!get_varint(&p, end, &dt))
+					return FALSE;
+				
+				g_array_append_val(records, ((replay_rec_t) {.type = tag}));
+				break;
+			
+			case TRACE_REC_REMOVE:
+				if(!get_varint(&p, end, &dt) || !get_varint(&p, end, &id)
+					|| id >= folders->len)
+					return FALSE;
+				
+				g_array_append_val(records, ((replay_rec_t) {
+					.type = tag, .folder = id}));
+				break;
+			
+			case TRACE_REC_RENAME:
+				if(!get_varint(&p, end, &dt) || !get_varint(&p, end, &id)
+					|| !get_varint(&p, end, &new_id)
+					|| id >= folders->len || new_id >= folders->len)
+					return FALSE;
+				
+				g_array_append_val(records, ((replay_rec_t) {
+					.type = tag, .folder = id, .new_folder = new_id}));
+				break;
+			
+			case TRACE_REC_UIDS: {
+				if(!get_varint(&p, end, &dt) || !get_varint(&p, end, &id)
+					|| id >= folders->len)
+					return FALSE;
+				
+				GPtrArray *added = get_uids(&p, end);
+				GPtrArray *gone = (added ? get_uids(&p, end) : NULL);
+				
+				if(!gone) {
+					g_clear_pointer(&added, g_ptr_array_unref);
+					return FALSE;
+				}
+				
+				g_array_append_val(records, ((replay_rec_t) {.type = tag,
+					.folder = id, .added = added, .gone = gone}));
+				break;
+			}
+			
+			default:
+				return FALSE;
+		}
+	}
+	
+	return TRUE;
+}
+
+static guint64 replay(GPtrArray *folders, GArray *records) {
+	unread = FALSE;
+	n_to_unread = n_to_read = 0;
+	
+	ucount_init(NULL, on_checkpoint);
+	
+	guint64 start = now_ns();
+	
+	for(guint i = 0; i < records->len; i++) {
+		replay_rec_t *rec = &g_array_index(records, replay_rec_t, i);
+		
+		if(rec->type == TRACE_REC_EVENT) {
+			gint delta = ucount_event(
+				g_ptr_array_index(folders, rec->folder), rec->count);
+			
+			if(delta > 0 && !unread) {
+				unread = TRUE;
+				n_to_unread++;
+			}
+		} else if(rec->type == TRACE_REC_REMOVE) {
+			ucount_remove(g_ptr_array_index(folders, rec->folder));
+		} else if(rec->type == TRACE_REC_RENAME) {
+			ucount_rename(g_ptr_array_index(folders, rec->folder),
+				g_ptr_array_index(folders, rec->new_folder));
+		} else if(rec->type == TRACE_REC_UIDS) {
+			gint delta = ucount_uids_changed(
+				g_ptr_array_index(folders, rec->folder), rec->added, rec->gone);
+			
+			if(delta > 0 && !unread) {
+				unread = TRUE;
+				n_to_unread++;
+			}
+		} else {
+			if(unread) {
+				unread = FALSE;
+				n_to_read++;
+			}
+			
+			ucount_set_checkpoint();
+		}
+	}
+	
+	guint64 elapsed = now_ns() - start;
+	
+	ucount_fini();
+	
+	return elapsed;
+}
+
+int main(int argc, char *argv[]) {
+	GOptionContext *ctx = g_option_context_new("TRACE - replay a trace");
+	GError *error = NULL;
+	gchar *data;
+	gsize len;
+	
+	g_option_context_add_main_entries(ctx, options, NULL);
+	
+	if(!g_option_context_parse(ctx, &argc, &argv, &error)) {
+		g_printerr("trace-replay: %s\n", error->message);
+		return 1;
+	}
+	
+	g_option_context_free(ctx);
+	
+	if(argc != 2) {
+		g_printerr("trace-replay: expected a single trace file\n");
+		return 1;
+	}
+	
+	if(!g_file_get_contents(argv[1], &data, &len, &error)) {
+		g_printerr("trace-replay: %s\n", error->message);
+		return 1;
+	}
+	
+	GPtrArray *folders = g_ptr_array_new_with_free_func(g_free);
+	GArray *records = g_array_new(FALSE, FALSE, sizeof(replay_rec_t));
+	g_array_set_clear_func(records, clear_rec);
+	
+	if(!parse_trace((const guchar *) data, len, folders, records)) {
+		/* A trace cut short (e.g. Evolution crashed) is still
+		 * useful; replay whatever could be parsed. */
+		g_printerr("trace-replay: %s: malformed or truncated trace\n", argv[1]);
+	}
+	
+	g_free(data);
+	
+	guint64 best = G_MAXUINT64;
+	for(gint i = 0; i < MAX(loops, 1); i++)
+		best = MIN(best, replay(folders, records));
+	
+	gdouble ns_per_rec = records->len ? (gdouble) best / records->len : 0;
+	
+	if(json) {
+		g_printf("{\"folders\": %u, \"records\": %u, \"best_ns\": %" G_GUINT64_FORMAT
+			", \"ns_per_record\": %.1f, \"to_unread\": %u, \"to_read\": %u, "
+			"\"final\": \"%s\"}\n", folders->len, records->len, best,
+			ns_per_rec, n_to_unread, n_to_read, unread ? "unread" : "read");
+	} else {
+		g_printf("folders: %u, records: %u\n", folders->len, records->len);
+		g_printf("replay:  %" G_GUINT64_FORMAT " ns (best of %d), %.1f ns/record\n",
+			best, MAX(loops, 1), ns_per_rec);
+		g_printf("status:  %u -> unread, %u -> read, final: %s\n",
+			n_to_unread, n_to_read, unread ? "unread" : "read");
+	}
+	
+	g_array_free(records, TRUE);
+	g_ptr_array_free(folders, TRUE);
+	
+	return 0;
+}
@@ -0,0 +1,280 @@
+/* Evoution Tray plugin
+ *  Copyright (C) 2025 George Katevenis <george_kate@hotmail.com>
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Synthetic driver for the ucount table, outside of Evolution. It replays
+ * a generated workload: N folders, with events distributed over them
+ * following a Zipf distribution (a few folders get most of the mail), a
+ * given ratio of 'read' (count decreases) vs 'arrival' (count increases)
+ * events, and a checkpoint every K events (the user looking at the app).
+ *
+ * The whole event stream is generated up front, so that only ucount
+ * itself is measured. It's replayed twice, on a fresh table each time:
+ * once as a whole for the throughput, and once timing every single event
+ * for the latency percentiles.
+ *
+ * The memory reported is ucount's own (table and prefix tree), as the
+ * table stands after the whole stream. The process' peak RSS is reported
+ * separately; it's dominated by the pre-generated stream and latencies. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include <gio/gio.h>
+#include <glib/gprintf.h>
+
+#include "ucount.h"
+
+typedef struct bench_event_t {
+	guint32 folder;
+	guint32 count;
+} bench_event_t;
+
+static gint n_folders = 20000;
+static gint n_events = 1000000;
+static gdouble zipf_s = 1.0;
+static gdouble read_ratio = 0.5;
+static gint checkpoint_every = 10000;
+static gint seed = 1;
+static gboolean json = FALSE;
+
+static GOptionEntry options[] = {
+	{"folders", 'n', 0, G_OPTION_ARG_INT, &n_folders,
+		"Number of folders", "N"},
+	{"events", 'e', 0, G_OPTION_ARG_INT, &n_events,
+		"Number of events", "N"},
+	{"zipf", 's', 0, G_OPTION_ARG_DOUBLE, &zipf_s,
+		"Zipf exponent of the event distribution over folders", "S"},
+	{"read-ratio", 'r', 0, G_OPTION_ARG_DOUBLE, &read_ratio,
+		"Fraction of events that are reads (count decreases)", "R"},
+	{"checkpoint-every", 'c', 0, G_OPTION_ARG_INT, &checkpoint_every,
+		"Set the checkpoint every N events (0: never)", "N"},
+	{"seed", 0, 0, G_OPTION_ARG_INT, &seed,
+		"Random seed", "N"},
+	{"json", 'j', 0, G_OPTION_ARG_NONE, &json,
+		"Output results as JSON", NULL},
+	{NULL}
+};
+
+static guint n_checkpoints_reached = 0;
+
+static void on_checkpoint(void) {
+	n_checkpoints_reached++;
+}
+
+static inline guint64 now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (guint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static gint cmp_u32(gconstpointer a, gconstpointer b) {
+	guint32 x = *(const guint32 *) a, y = *(const guint32 *) b;
+	return (x > y) - (x < y);
+}
+
+// Cumulative Zipf distribution over the folders
+static gdouble *zipf_cdf(void) {
+	gdouble *cdf = g_new(gdouble, n_folders);
+	gdouble sum = 0;
+	
+	for(gint i = 0; i < n_folders; i++) {
+		sum += 1.0 / pow(i + 1, zipf_s);
+		cdf[i] = sum;
+	}
+	
+	for(gint i = 0; i < n_folders; i++)
+		cdf[i] /= sum;
+	
+	return cdf;
+}
+
+static guint32 zipf_sample(const gdouble *cdf, gdouble u) {
+	guint32 lo = 0, hi = n_folders - 1;
+	
+	while(lo < hi) {
+		guint32 mid = lo + (hi - lo) / 2;
+		
+		if(cdf[mid] < u)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	
+	return lo;
+}
+
+static bench_event_t *generate_events(void) {
+	bench_event_t *events = g_new(bench_event_t, n_events);
+	guint32 *counts = g_new0(guint32, n_folders);
+	gdouble *cdf = zipf_cdf();
+	GRand *rand = g_rand_new_with_seed(seed);
+	
+	/* Which folder gets which popularity rank is itself random, so that
+	 * hot folders don't end up clustered in the table. */
+	guint32 *rank_to_folder = g_new(guint32, n_folders);
+	for(gint i = 0; i < n_folders; i++)
+		rank_to_folder[i] = i;
+	for(gint i = n_folders - 1; i > 0; i--) {
+		gint j = g_rand_int_range(rand, 0, i + 1);
+		guint32 tmp = rank_to_folder[i];
+		rank_to_folder[i] = rank_to_folder[j];
+		rank_to_folder[j] = tmp;
+	}
+	
+	for(gint i = 0; i < n_events; i++) {
+		guint32 folder = rank_to_folder[
+			zipf_sample(cdf, g_rand_double(rand))];
+		
+		if(g_rand_double(rand) < read_ratio) {
+			if(counts[folder] > 0)
+				counts[folder]--;
+		} else
+			counts[folder]++;
+		
+		events[i] = (bench_event_t) {.folder = folder, .count = counts[folder]};
+	}
+	
+	g_rand_free(rand);
+	g_free(rank_to_folder);
+	g_free(cdf);
+	g_free(counts);
+	
+	return events;
+}
+
+static gchar **generate_uris(void) {
+	gchar **uris = g_new0(gchar *, n_folders + 1);
+	
+	for(gint i = 0; i < n_folders; i++) {
+		uris[i] = g_strdup_printf("folder://%u@example.org/INBOX/folder-%u",
+			i % 8, i);
+	}
+	
+	return uris;
+}
+
+static gdouble run_throughput(gchar **uris,
+	const bench_event_t *events, gsize *table_bytes)
+{
+	ucount_init(NULL, on_checkpoint);
+	
+	guint64 start = now_ns();
+	
+	for(gint i = 0; i < n_events; i++) {
+		ucount_event(uris[events[i].folder], events[i].count);
+		
+		if(checkpoint_every > 0 && (i + 1) % checkpoint_every == 0)
+			ucount_set_checkpoint();
+	}
+	
+	guint64 end = now_ns();
+	
+	*table_bytes = ucount_get_memory();
+	ucount_fini();
+	
+	return n_events / ((end - start) / 1e9);
+}
+
+static guint32 *run_latency(gchar **uris, const bench_event_t *events) {
+	guint32 *lat = g_new(guint32, n_events);
+	
+	ucount_init(NULL, on_checkpoint);
+	
+	for(gint i = 0; i < n_events; i++) {
+		guint64 start = now_ns();
+		
+		ucount_event(uris[events[i].folder], events[i].count);
+		
+		if(checkpoint_every > 0 && (i + 1) % checkpoint_every == 0)
+			ucount_set_checkpoint();
+		
+		lat[i] = MIN(now_ns() - start, G_MAXUINT32);
+	}
+	
+	ucount_fini();
+	
+	qsort(lat, n_events, sizeof(*lat), cmp_u32);
+	return lat;
+}
+
+int main(int argc, char *argv[]) {
+	GOptionContext *ctx = g_option_context_new("- ucount benchmark");
+	GError *error = NULL;
+	
+	g_option_context_add_main_entries(ctx, options, NULL);
+	
+	if(!g_option_context_parse(ctx, &argc, &argv, &error)) {
+		g_printerr("ucount-bench: %s\n", error->message);
+		return 1;
+	}
+	
+	g_option_context_free(ctx);
+	
+	if(n_folders <= 0 || n_events <= 0) {
+		g_printerr("ucount-bench: need at least one folder and one event\n");
+		return 1;
+	}
+	
+	gchar **uris = generate_uris();
+	bench_event_t *events = generate_events();
+	
+	gsize table_bytes;
+	
+	gdouble events_per_sec = run_throughput(uris, events, &table_bytes);
+	guint32 *lat = run_latency(uris, events);
+	
+	#define PCT(p) lat[(gsize) ((n_events - 1) * (p))]
+	
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	
+	if(json) {
+		g_printf("{\"folders\": %d, \"events\": %d, \"zipf\": %g, "
+			"\"read_ratio\": %g, \"checkpoint_every\": %d, \"seed\": %d, "
+			"\"events_per_sec\": %.0f, \"ns_per_event\": {\"p50\": %u, "
+			"\"p90\": %u, \"p99\": %u, \"p999\": %u, \"max\": %u}, "
+			"\"ucount_kb\": %" G_GSIZE_FORMAT ", \"process_peak_rss_kb\": %ld}\n",
+			n_folders, n_events, zipf_s, read_ratio, checkpoint_every, seed,
+			events_per_sec, PCT(0.5), PCT(0.9), PCT(0.99), PCT(0.999),
+			lat[n_events - 1], table_bytes / 1024, usage.ru_maxrss);
+	} else {
+		g_printf("folders: %d, events: %d, zipf: %g, read ratio: %g, "
+			"checkpoint every: %d\n", n_folders, n_events, zipf_s,
+			read_ratio, checkpoint_every);
+		g_printf("throughput:   %.0f events/s\n", events_per_sec);
+		g_printf("ns/event:     p50 %u, p90 %u, p99 %u, p99.9 %u, max %u\n",
+			PCT(0.5), PCT(0.9), PCT(0.99), PCT(0.999), lat[n_events - 1]);
+		g_printf("ucount:       %" G_GSIZE_FORMAT " KiB\n", table_bytes / 1024);
+		g_printf("process RSS:  %ld KiB peak (incl. the harness)\n",
+			usage.ru_maxrss);
+	}
+	
+	#undef PCT
+	
+	g_free(lat);
+	g_free(events);
+	g_strfreev(uris);
+	
+	return 0;
+}
@@ -0,0 +1,206 @@
+/* Evoution Tray plugin
+ *  Copyright (C) 2025 George Katevenis <george_kate@hotmail.com>
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Tray icon pixmaps with a new mail count badge, for the SNI IconPixmap
+ * property. Rendering them (theme lookup, rasterizing, text) isn't free,
+ * and hosts re-fetch the icon on every NewIcon, so the rendered pixmaps
+ * are kept in a small LRU cache, keyed by (icon, count, size).
+ *
+ * The cached values are ready-to-send GVariants, in the format SNI wants:
+ * (width, height, ARGB32 pixels in network byte order). A property Get
+ * only has to reference them. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtk/gtk.h>
+#include <glib.h>
+#include <glib/gprintf.h>
+
+#include "badge.h"
+
+#define BADGE_CACHE_SIZE 32
+
+// The sizes we offer; hosts pick (and scale) the closest one
+static const gint badge_sizes[] = {16, 22, 32, 48};
+
+typedef struct badge_entry_t {
+	gchar *key;
+	GVariant *pixmap;
+} badge_entry_t;
+
+// Most recently used at the head; the hash table maps keys to queue links
+static GQueue lru = G_QUEUE_INIT;
+static GHashTable *cache = NULL;
+
+static void entry_free(badge_entry_t *entry) {
+	g_variant_unref(entry->pixmap);
+	g_free(entry->key);
+	g_free(entry);
+}
+
+void badge_clear_cache(void) {
+	g_clear_pointer(&cache, g_hash_table_destroy);
+	
+	g_queue_clear_full(&lru, (GDestroyNotify) entry_free);
+}
+
+static void draw_badge(cairo_t *cr, gint size, guint count) {
+	gchar text[8];
+	cairo_text_extents_t ext;
+	
+	if(count > BADGE_MAX_COUNT)
+		g_snprintf(text, sizeof(text), "%u+", BADGE_MAX_COUNT);
+	else
+		g_snprintf(text, sizeof(text), "%u", count);
+	
+	cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL,
+		CAIRO_FONT_WEIGHT_BOLD);
+	cairo_set_font_size(cr, size * 0.45);
+	cairo_text_extents(cr, text, &ext);
+	
+	// A pill in the bottom-right corner, growing leftwards with the text
+	gdouble h = size * 0.55;
+	gdouble w = MAX(h, ext.width + h * 0.5);
+	gdouble x = size - w, y = size - h, r = h / 2;
+	
+	cairo_new_sub_path(cr);
+	cairo_arc(cr, x + w - r, y + r, r, -G_PI / 2, G_PI / 2);
+	cairo_arc(cr, x + r, y + r, r, G_PI / 2, 3 * G_PI / 2);
+	cairo_close_path(cr);
+	
+	cairo_set_source_rgb(cr, 0.85, 0.1, 0.1);
+	cairo_fill(cr);
+	
+	cairo_set_source_rgb(cr, 1, 1, 1);
+	cairo_move_to(cr, x + (w - ext.width) / 2 - ext.x_bearing,
+		y + (h - ext.height) / 2 - ext.y_bearing);
+	cairo_show_text(cr, text);
+}
+
+/* Cairo gives native-endian, premultiplied ARGB32. SNI wants it
+ * straight (not premultiplied), in network byte order. */
+static GVariant *surface_to_variant(cairo_surface_t *surface, gint size) {
+	cairo_surface_flush(surface);
+	
+	const guchar *src = cairo_image_surface_get_data(surface);
+	gint stride = cairo_image_surface_get_stride(surface);
+	
+	gsize len = (gsize) size * size * 4;
+	guchar *data = g_malloc(len), *dst = data;
+	
+	for(gint y = 0; y < size; y++) {
+		const guint32 *row = (const guint32 *) (src + y * stride);
+		
+		for(gint x = 0; x < size; x++) {
+			guint32 px = row[x];
+			guint a = px >> 24;
+			guint r = (px >> 16) & 0xff, g = (px >> 8) & 0xff, b = px & 0xff;
+			
+			if(a > 0 && a < 255) {
+				r = r * 255 / a;
+				g = g * 255 / a;
+				b = b * 255 / a;
+			}
+			
+			*dst++ = a;
+			*dst++ = r;
+			*dst++ = g;
+			*dst++ = b;
+		}
+	}
+	
+	GVariant *bytes = g_variant_new_from_data(G_VARIANT_TYPE_BYTESTRING,
+		data, len, TRUE, g_free, data);
+	
+	return g_variant_new("(ii@ay)", size, size, bytes);
+}
+
+static GVariant *render(const gchar *icon_name, guint count, gint size) {
+	cairo_surface_t *surface = cairo_image_surface_create(
+		CAIRO_FORMAT_ARGB32, size, size);
+	cairo_t *cr = cairo_create(surface);
+	
+	GdkPixbuf *icon = gtk_icon_theme_load_icon(gtk_icon_theme_get_default(),
+		icon_name, size, GTK_ICON_LOOKUP_FORCE_SIZE, NULL);
+	
+	if(icon) {
+		gdk_cairo_set_source_pixbuf(cr, icon, 0, 0);
+		cairo_paint(cr);
+		g_object_unref(icon);
+	}
+	
+	if(count > 0)
+		draw_badge(cr, size, count);
+	
+	cairo_destroy(cr);
+	
+	GVariant *pixmap = surface_to_variant(surface, size);
+	cairo_surface_destroy(surface);
+	
+	return g_variant_ref_sink(pixmap);
+}
+
+static GVariant *lookup(const gchar *icon_name, guint count, gint size) {
+	gchar *key = g_strdup_printf("%s:%u:%d", icon_name, count, size);
+	
+	if(!cache)
+		cache = g_hash_table_new(g_str_hash, g_str_equal);
+	
+	GList *link = g_hash_table_lookup(cache, key);
+	
+	if(link) {
+		g_queue_unlink(&lru, link);
+		g_queue_push_head_link(&lru, link);
+		
+		g_free(key);
+		return ((badge_entry_t *) link->data)->pixmap;
+	}
+	
+	if(lru.length >= BADGE_CACHE_SIZE) {
+		badge_entry_t *oldest = g_queue_pop_tail(&lru);
+		g_hash_table_remove(cache, oldest->key);
+		entry_free(oldest);
+	}
+	
+	badge_entry_t *entry = g_new(badge_entry_t, 1);
+	entry->key = key;
+	entry->pixmap = render(icon_name, count, size);
+	
+	g_queue_push_head(&lru, entry);
+	g_hash_table_insert(cache, entry->key, lru.head);
+	
+	return entry->pixmap;
+}
+
+/* a(iiay), one pixmap per offered size, of the icon with the badge. A
+ * count of 0 means no badge. Returns a floating reference. */
+GVariant *badge_get_pixmaps(const gchar *icon_name, guint count) {
+	GVariantBuilder builder;
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a(iiay)"));
+	
+	count = MIN(count, BADGE_MAX_COUNT + 1);
+	
+	for(guint i = 0; i < G_N_ELEMENTS(badge_sizes); i++) {
+		g_variant_builder_add_value(&builder,
+			lookup(icon_name, count, badge_sizes[i]));
+	}
+	
+	return g_variant_builder_end(&builder);
+}
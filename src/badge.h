@@ -0,0 +1,10 @@
+#ifndef EVOLUTION_TRAY_BADGE_H
+#define EVOLUTION_TRAY_BADGE_H
+
+// Badge counts above this are all shown (and cached) as "N+"
+#define BADGE_MAX_COUNT 99
+
+GVariant *badge_get_pixmaps(const gchar *icon_name, guint count);
+void badge_clear_cache(void);
+
+#endif
@@ -0,0 +1,124 @@
+/* Evoution Tray plugin
+ *  Copyright (C) 2025 George Katevenis <george_kate@hotmail.com>
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Always-on log of the last EVLOG_SIZE plugin events (folder events,
+ * status transitions, D-Bus errors, etc.), for postmortems of icon-state
+ * problems in the field. Adding an event fills in one fixed-size slot of a
+ * static ring; no allocation, no formatting, no locks. It's dumped on
+ * demand over D-Bus by sn.c, e.g.:
+ *
+ * gdbus call --session --dest org.gnome.evolution.plugin.evolution-tray \
+ *   --object-path /Stats --method org.gnome.evolution.plugin.EvolutionTray.Stats.GetEvents
+ *
+ * Everything currently runs on the main thread, but slots are claimed with
+ * an atomic increment, so events may also be added from other threads.
+ * Each slot has a sequence number that is cleared while it's being written,
+ * and set last, so that the dump can skip torn or overwritten entries. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <gio/gio.h>
+#include <glib/gprintf.h>
+
+#include "evlog.h"
+#include "stats.h"
+
+G_STATIC_ASSERT((EVLOG_SIZE & (EVLOG_SIZE - 1)) == 0);
+
+typedef struct evlog_entry_t {
+	guint seq; // the event's index + 1, 0 while being written
+	evlog_type_t type;
+	guint64 time_ns; // stats_now()
+	gint a, b;
+	gchar text[EVLOG_TEXT_SIZE];
+} evlog_entry_t;
+
+static evlog_entry_t ring[EVLOG_SIZE];
+static guint head = 0;
+
+static const gchar *type_names[EVLOG_N_TYPES] = {
+	[EVLOG_FOLDER_EVENT] = "folder-event",
+	[EVLOG_FOLDER_UIDS] = "folder-uids",
+	[EVLOG_STATUS] = "status",
+	[EVLOG_ICON] = "icon",
+	[EVLOG_WINDOW_ACTION] = "window-action",
+	[EVLOG_DBUS_ERROR] = "dbus-error",
+};
+
+// text may be NULL
+void evlog_add(evlog_type_t type, gint a, gint b, const gchar *text) {
+	guint index = (guint) g_atomic_int_add(&head, 1);
+	evlog_entry_t *e = &ring[index & (EVLOG_SIZE - 1)];
+	
+	g_atomic_int_set(&e->seq, 0);
+	
+	e->type = type;
+	e->time_ns = stats_now();
+	e->a = a;
+	e->b = b;
+	
+	gsize len = (text ? strlen(text) : 0);
+	
+	// The end of a URI (the folder) says more than its start
+	if(len >= EVLOG_TEXT_SIZE) {
+		text += len - (EVLOG_TEXT_SIZE - 1);
+		len = EVLOG_TEXT_SIZE - 1;
+	}
+	
+	if(len > 0)
+		memcpy(e->text, text, len);
+	
+	e->text[len] = '\0';
+	
+	g_atomic_int_set(&e->seq, index + 1);
+}
+
+/* (ta(tsiis)): the current time, and the events, oldest first, each with
+ * its time, type, a, b and text. Times are from stats_now(), in ns. */
+GVariant *evlog_to_variant(void) {
+	GVariantBuilder builder;
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a(tsiis)"));
+	
+	guint end = (guint) g_atomic_int_get(&head);
+	guint start = (end > EVLOG_SIZE ? end - EVLOG_SIZE : 0);
+	
+	for(guint index = start; index != end; index++) {
+		evlog_entry_t *e = &ring[index & (EVLOG_SIZE - 1)];
+		
+		if((guint) g_atomic_int_get(&e->seq) != index + 1)
+			continue;
+		
+		evlog_entry_t copy = *e;
+		
+		// Overwritten while copying
+		if((guint) g_atomic_int_get(&e->seq) != index + 1)
+			continue;
+		
+		copy.text[EVLOG_TEXT_SIZE - 1] = '\0';
+		
+		g_variant_builder_add(&builder, "(tsiis)", copy.time_ns,
+			type_names[copy.type], copy.a, copy.b, copy.text);
+	}
+	
+	return g_variant_new("(t@a(tsiis))", stats_now(),
+		g_variant_builder_end(&builder));
+}
@@ -0,0 +1,31 @@
+#ifndef EVOLUTION_TRAY_EVLOG_H
+#define EVOLUTION_TRAY_EVLOG_H
+
+// Number of events kept; a power of 2
+#define EVLOG_SIZE 512
+
+// Longest text kept with an event (incl. the NUL); longer ones keep the end
+#define EVLOG_TEXT_SIZE 100
+
+/* Event types, and what goes in their (a, b, text):
+ * - EVLOG_FOLDER_EVENT: unread count, new mail delta, folder URI
+ * - EVLOG_FOLDER_UIDS: added, gone, folder URI (new mail delta in a - b)
+ * - EVLOG_STATUS: new status (tray.c), checkpoint set
+ * - EVLOG_ICON: -, -, icon name
+ * - EVLOG_WINDOW_ACTION: requested action, action taken (tray.h)
+ * - EVLOG_DBUS_ERROR: error code, -, what failed and why */
+typedef enum {
+	EVLOG_FOLDER_EVENT,
+	EVLOG_FOLDER_UIDS,
+	EVLOG_STATUS,
+	EVLOG_ICON,
+	EVLOG_WINDOW_ACTION,
+	EVLOG_DBUS_ERROR,
+	
+	EVLOG_N_TYPES
+} evlog_type_t;
+
+void evlog_add(evlog_type_t type, gint a, gint b, const gchar *text);
+GVariant *evlog_to_variant(void);
+
+#endif
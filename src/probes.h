@@ -0,0 +1,29 @@
+#ifndef EVOLUTION_TRAY_PROBES_H
+#define EVOLUTION_TRAY_PROBES_H
+
+/* Static tracepoints (USDT), for perf, bpftrace, systemtap, etc. Only with
+ * -Dusdt=true; otherwise they compile to nothing, and their arguments are
+ * not evaluated. Each one is a nop until something attaches to it. E.g.:
+ *
+ * bpftrace -e 'usdt:/path/to/liborg-gnome-evolution-tray.so:evolution_tray:
+ *   folder_event { printf("%s %d\n", str(arg0), arg2); }' -p <evolution pid> */
+
+#ifdef HAVE_USDT
+
+#include <sys/sdt.h>
+
+#define PROBE(name) DTRACE_PROBE(evolution_tray, name)
+#define PROBE1(name, a) DTRACE_PROBE1(evolution_tray, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(evolution_tray, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(evolution_tray, name, a, b, c)
+
+#else
+
+#define PROBE(name) do {} while(0)
+#define PROBE1(name, a) do {} while(0)
+#define PROBE2(name, a, b) do {} while(0)
+#define PROBE3(name, a, b, c) do {} while(0)
+
+#endif
+
+#endif
@@ -53,6 +53,81 @@ set_part_enabled(gchar *schema, const gchar *key, gboolean enable)
 	g_object_unref (settings);
 }
 
+/******************************************************************************
+ * Settings cache
+ *****************************************************************************/
+tray_settings_t tray_settings;
+
+static GSettings *cached_settings = NULL;
+static void (*settings_changed_cb)(const gchar *key) = NULL;
+
+static void
+load_settings(void)
+{
+	g_strfreev(tray_settings.folder_include);
+	g_strfreev(tray_settings.folder_exclude);
+	
+	tray_settings = (tray_settings_t) {
+		.hidden_on_startup = g_settings_get_boolean(cached_settings,
+			CONF_KEY_HIDDEN_ON_STARTUP),
+		.hide_on_minimize = g_settings_get_boolean(cached_settings,
+			CONF_KEY_HIDE_ON_MINIMIZE),
+		.hide_on_close = g_settings_get_boolean(cached_settings,
+			CONF_KEY_HIDE_ON_CLOSE),
+		.icon_update_interval = g_settings_get_uint(cached_settings,
+			CONF_KEY_ICON_UPDATE_INTERVAL),
+		.unread_badge = g_settings_get_boolean(cached_settings,
+			CONF_KEY_UNREAD_BADGE),
+		.folder_include = g_settings_get_strv(cached_settings,
+			CONF_KEY_FOLDER_INCLUDE),
+		.folder_exclude = g_settings_get_strv(cached_settings,
+			CONF_KEY_FOLDER_EXCLUDE),
+		.max_folders = g_settings_get_uint(cached_settings,
+			CONF_KEY_MAX_FOLDERS),
+	};
+}
+
+static void
+settings_changed(GSettings *settings, const gchar *key, gpointer data)
+{
+	// Just a handful of keys, simply re-read them all
+	load_settings();
+	
+	if(settings_changed_cb)
+		settings_changed_cb(key);
+}
+
+gint
+properties_init(void (*changed_cb)(const gchar *key))
+{
+	cached_settings = g_settings_new(TRAY_SCHEMA);
+	if(!cached_settings)
+		return -1;
+	
+	load_settings();
+	
+	settings_changed_cb = changed_cb;
+	g_signal_connect(cached_settings, "changed",
+		G_CALLBACK(settings_changed), NULL);
+	
+	return 0;
+}
+
+void
+properties_fini(void)
+{
+	if(cached_settings) {
+		g_signal_handlers_disconnect_by_func(cached_settings,
+			settings_changed, NULL);
+		g_clear_object(&cached_settings);
+	}
+	
+	g_clear_pointer(&tray_settings.folder_include, g_strfreev);
+	g_clear_pointer(&tray_settings.folder_exclude, g_strfreev);
+	
+	settings_changed_cb = NULL;
+}
+
 /******************************************************************************
  * Callback for configuration widget
  *****************************************************************************/
@@ -80,6 +155,14 @@ toggle_hidden_on_close_cb(GtkWidget *widget, gpointer data)
 			gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget)));
 }
 
+static void
+toggled_unread_badge_cb(GtkWidget *widget, gpointer data)
+{
+	g_return_if_fail(widget != NULL);
+	set_part_enabled(TRAY_SCHEMA, CONF_KEY_UNREAD_BADGE,
+			gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget)));
+}
+
 /******************************************************************************
  * Properties widget
  *****************************************************************************/
@@ -128,6 +211,13 @@ get_cfg_widget()
 		G_CALLBACK(toggle_hidden_on_close_cb), NULL);
 	gtk_box_pack_start(GTK_BOX(container), check, FALSE, FALSE, 0);
 	
+	check = gtk_check_button_new_with_mnemonic(_("Show new mail count on the icon"));
+	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(check),
+		is_part_enabled(TRAY_SCHEMA, CONF_KEY_UNREAD_BADGE));
+	g_signal_connect(G_OBJECT(check), "toggled",
+		G_CALLBACK(toggled_unread_badge_cb), NULL);
+	gtk_box_pack_start(GTK_BOX(container), check, FALSE, FALSE, 0);
+	
 	gtk_widget_show_all(container);
 	
 	return container;
@@ -7,6 +7,30 @@
 #define CONF_KEY_HIDDEN_ON_STARTUP		"hidden-on-startup"
 #define CONF_KEY_HIDE_ON_MINIMIZE		"hide-on-minimize"
 #define CONF_KEY_HIDE_ON_CLOSE			"hide-on-close"
+#define CONF_KEY_ICON_UPDATE_INTERVAL	"icon-update-interval"
+#define CONF_KEY_UNREAD_BADGE			"unread-badge"
+#define CONF_KEY_FOLDER_INCLUDE			"folder-include"
+#define CONF_KEY_FOLDER_EXCLUDE			"folder-exclude"
+#define CONF_KEY_MAX_FOLDERS			"max-folders"
+
+/* Cached copy of our settings, kept up to date through GSettings change
+ * notifications. Meant for hot paths (e.g. window event handlers). Only
+ * valid between properties_init() and properties_fini(). */
+typedef struct tray_settings_t {
+	gboolean hidden_on_startup;
+	gboolean hide_on_minimize;
+	gboolean hide_on_close;
+	guint icon_update_interval;
+	gboolean unread_badge;
+	gchar **folder_include;
+	gchar **folder_exclude;
+	guint max_folders;
+} tray_settings_t;
+
+extern tray_settings_t tray_settings;
+
+gint properties_init(void (*changed_cb)(const gchar *key));
+void properties_fini(void);
 
 gboolean is_part_enabled(gchar *schema, const gchar *key);
 void properties_show(void);
@@ -23,73 +23,285 @@
 #include <gio/gio.h>
 #include <glib/gprintf.h>
 
+#include <libdbusmenu-glib/client.h>
 #include <libdbusmenu-glib/server.h>
 
 #include "sn.h"
+#include "sn-dbus.h"
 #include "tray.h"
+#include "stats.h"
+#include "badge.h"
 #include "properties.h"
+#include "probes.h"
+#include "evlog.h"
 
 #define MENU_MANUAL_ACTION_ITEM_ID 101
 
-static const gchar introspection_xml[] =
-"<node>"
-"  <interface name='" SNI_INTERFACE "'>"
-"	<method name='Activate'>"
-"	  <arg type='i' name='x' direction='in'/>"
-"	  <arg type='i' name='y' direction='in'/>"
-"	</method>"
-"	<property name='Category' type='s' access='read'/>"
-"	<property name='Id' type='s' access='read'/>"
-"	<property name='Title' type='s' access='read'/>"
-"	<property name='Status' type='s' access='read'/>"
-"	<property name='IconName' type='s' access='read'/>"
-"	<property name='ItemIsMenu' type='b' access='read'/>"
-"	<property name='Menu' type='o' access='read'/>"
-"  </interface>"
-"</node>";
-
 static GDBusConnection *bus = NULL;
 static guint owner_id = 0;
 static guint registration_id = 0;
+static guint stats_registration_id = 0;
+static guint counts_registration_id = 0;
 static guint subscription_id = 0;
+static GCancellable *cancellable = NULL;
 DbusmenuServer *menu_server = NULL;
 
+/* The icon as last set, and the icon as last announced on the bus.
+ * Property Gets serve the latter, so that an intermediate state that
+ * was never announced can't leak out either. */
 static const gchar *current_icon = NULL;
+static const gchar *published_icon = NULL;
+
+// Same, for the mail counts shown in the Title and ToolTip
+static guint current_unread = 0, current_new = 0;
+static guint published_unread = 0, published_new = 0;
+
+/* When enabled, the icon carries a badge with the new mail count, and is
+ * sent as a pixmap instead of by name. 0 means no badge. */
+static gboolean badge_enabled = FALSE;
+static guint published_badge = 0;
+
+// Extra lines for the ToolTip (e.g. per-account counts)
+static gchar *current_details = NULL;
+static gchar *published_details = NULL;
+
+// Per-account counts for the Counts interface, a{s(suu)}; NULL if none
+static GVariant *current_accounts = NULL;
+static GVariant *published_accounts = NULL;
+
+/* Change signals are rate-limited, with trailing-edge coalescing: a change
+ * arms a timer (if not already armed), and when it fires, a signal is only
+ * emitted for what actually differs from what was last announced. */
+typedef enum {
+	SN_CHANGE_ICON = 1 << 0,
+	SN_CHANGE_COUNTS = 1 << 1,
+} sn_change_t;
+
+static guint pending_changes = 0;
+static guint update_interval = SN_DEFAULT_UPDATE_INTERVAL;
+static guint update_timeout_id = 0;
+
+/* SNI properties. Hosts re-fetch all of them on every NewIcon and on every
+ * (re-)registration, so the values are kept in a cache, and only re-built
+ * when the published state changes. The constant ones are built once. */
+typedef enum {
+	SN_PROP_CATEGORY,
+	SN_PROP_ID,
+	SN_PROP_TITLE,
+	SN_PROP_STATUS,
+	SN_PROP_ICON_NAME,
+	SN_PROP_ICON_PIXMAP,
+	SN_PROP_ITEM_IS_MENU,
+	SN_PROP_MENU,
+	SN_PROP_TOOLTIP,
+	SN_N_PROPS
+} sn_prop_t;
+
+static const gchar *const prop_names[SN_N_PROPS] = {
+	[SN_PROP_CATEGORY] = "Category",
+	[SN_PROP_ID] = "Id",
+	[SN_PROP_TITLE] = "Title",
+	[SN_PROP_STATUS] = "Status",
+	[SN_PROP_ICON_NAME] = "IconName",
+	[SN_PROP_ICON_PIXMAP] = "IconPixmap",
+	[SN_PROP_ITEM_IS_MENU] = "ItemIsMenu",
+	[SN_PROP_MENU] = "Menu",
+	[SN_PROP_TOOLTIP] = "ToolTip",
+};
+
+static GQuark prop_quarks[SN_N_PROPS];
+
+// Non-floating; NULL if not built yet, or invalidated
+static GVariant *prop_cache[SN_N_PROPS];
 
 static void register_with_watcher(void);
 
+// A D-Bus failure; on stderr, and in the event log with more detail
+static void report_error(const gchar *what, const GError *error) {
+	gchar *text = g_strdup_printf("%s: %s", what, error->message);
+	
+	g_printerr("Evolution Tray: dbus: %s\n", text);
+	evlog_add(EVLOG_DBUS_ERROR, error->code, 0, text);
+	
+	g_free(text);
+}
+
 // -----------------------------
 
+static GVariant *build_title(void) {
+	if(published_new == 0)
+		return g_variant_new_string("Evolution Tray");
+	
+	return g_variant_new_take_string(g_strdup_printf(
+		"Evolution Tray (%u new)", published_new));
+}
+
+static GVariant *build_tooltip(void) {
+	gchar *text;
+	
+	if(published_unread == 0)
+		text = g_strdup("No unread mail");
+	else if(published_details && *published_details) {
+		text = g_strdup_printf("%u unread, %u new\n%s",
+			published_unread, published_new, published_details);
+	} else
+		text = g_strdup_printf("%u unread, %u new", published_unread, published_new);
+	
+	/* Icon name, icon pixmaps, title, description. No icon of its
+	 * own; hosts use the item's icon. */
+	GVariant *tooltip = g_variant_new("(s@a(iiay)ss)", "",
+		g_variant_new_array(G_VARIANT_TYPE("(iiay)"), NULL, 0),
+		"Evolution", text);
+	
+	g_free(text);
+	return tooltip;
+}
+
+static GVariant *build_property(sn_prop_t prop) {
+	switch(prop) {
+		case SN_PROP_CATEGORY:
+			return g_variant_new_string("ApplicationStatus");
+		case SN_PROP_ID:
+			return g_variant_new_string("Evolution Tray");
+		case SN_PROP_TITLE:
+			return build_title();
+		case SN_PROP_STATUS:
+			return g_variant_new_string("Active");
+		case SN_PROP_ICON_NAME:
+			return g_variant_new_string(published_badge ? "" : published_icon);
+		case SN_PROP_ICON_PIXMAP:
+			if(published_badge)
+				return badge_get_pixmaps(published_icon, published_badge);
+			
+			return g_variant_new_array(G_VARIANT_TYPE("(iiay)"), NULL, 0);
+		case SN_PROP_ITEM_IS_MENU:
+			return g_variant_new_boolean(FALSE);
+		case SN_PROP_MENU:
+			return g_variant_new_object_path("/Menu");
+		case SN_PROP_TOOLTIP:
+			return build_tooltip();
+		default:
+			g_return_val_if_reached(NULL);
+	}
+}
+
+// Returns a borrowed reference
+static GVariant *get_property(sn_prop_t prop) {
+	if(!prop_cache[prop])
+		prop_cache[prop] = g_variant_ref_sink(build_property(prop));
+	
+	return prop_cache[prop];
+}
+
+static void invalidate_property(sn_prop_t prop) {
+	g_clear_pointer(&prop_cache[prop], g_variant_unref);
+}
+
+// Returns SN_N_PROPS if the property is not known
+static sn_prop_t lookup_property(const gchar *property_name) {
+	GQuark quark = g_quark_try_string(property_name);
+	sn_prop_t prop;
+	
+	for(prop = 0; prop < SN_N_PROPS; prop++) {
+		if(prop_quarks[prop] == quark)
+			break;
+	}
+	
+	return prop;
+}
+
+/* There's no get_property() in the vtable, so the Properties interface
+ * calls land here, and GetAll can be answered from the cache in one go,
+ * rather than with a get_property() call per property. GDBus has already
+ * checked that the interface and property are valid and readable. */
+static void on_properties_call(const gchar *method_name,
+	GVariant *params, GDBusMethodInvocation *inv)
+{
+	guint64 start = stats_now();
+	
+	if(g_strcmp0(method_name, "Get") == 0) {
+		const gchar *property_name;
+		g_variant_get(params, "(&s&s)", NULL, &property_name);
+		
+		sn_prop_t prop = lookup_property(property_name);
+		
+		if(prop == SN_N_PROPS) {
+			g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
+				G_DBUS_ERROR_INVALID_ARGS, "No such property '%s'", property_name);
+			return;
+		}
+		
+		g_dbus_method_invocation_return_value(inv,
+			g_variant_new("(v)", get_property(prop)));
+		
+	} else if(g_strcmp0(method_name, "GetAll") == 0) {
+		GVariantBuilder builder;
+		g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+		
+		for(sn_prop_t prop = 0; prop < SN_N_PROPS; prop++) {
+			g_variant_builder_add(&builder, "{sv}",
+				prop_names[prop], get_property(prop));
+		}
+		
+		g_dbus_method_invocation_return_value(inv,
+			g_variant_new("(a{sv})", &builder));
+		
+	} else {
+		g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
+			G_DBUS_ERROR_PROPERTY_READ_ONLY, "All properties are read-only");
+		return;
+	}
+	
+	stats_record(STATS_PROPERTY_GET, start);
+}
+
 static void on_method_call(GDBusConnection *conn, const gchar *sender,
 	const gchar *object_path, const gchar *iface, const gchar *method_name,
 	GVariant *params, GDBusMethodInvocation *inv, gpointer data)
 {
+	if(g_strcmp0(iface, "org.freedesktop.DBus.Properties") == 0) {
+		on_properties_call(method_name, params, inv);
+		return;
+	}
+	
 	if(g_strcmp0(method_name, "Activate") == 0) {
-		tray_action(ACTION_AUTO);
-		g_dbus_method_invocation_return_value(inv, NULL);
+		tray_activate(ACTION_AUTO);
 	}
+	else if(g_strcmp0(method_name, "SecondaryActivate") == 0) {
+		tray_activate(ACTION_PRESENT);
+	}
+	
+	// Scroll is accepted, but there's nothing to scroll through
+	g_dbus_method_invocation_return_value(inv, NULL);
 }
 
-static GVariant *on_get_property(GDBusConnection *conn, const gchar *sender,
-	const gchar *object_path, const gchar *interface_name, const gchar *property_name,
-	GError **error, gpointer data)
+static void on_stats_method_call(GDBusConnection *conn, const gchar *sender,
+	const gchar *object_path, const gchar *iface, const gchar *method_name,
+	GVariant *params, GDBusMethodInvocation *inv, gpointer data)
 {
-	if(g_strcmp0(property_name, "Category") == 0)
-		return g_variant_new_string("ApplicationStatus");
-	if(g_strcmp0(property_name, "Id") == 0)
-		return g_variant_new_string("Evolution Tray");
-	if(g_strcmp0(property_name, "Title") == 0)
-		return g_variant_new_string("Evolution Tray");
-	if(g_strcmp0(property_name, "Status") == 0)
-		return g_variant_new_string("Active");
-	if(g_strcmp0(property_name, "IconName") == 0)
-		return g_variant_new_string(current_icon);
-	if(g_strcmp0(property_name, "ItemIsMenu") == 0)
-		return g_variant_new_boolean(FALSE);
-	if(g_strcmp0(property_name, "Menu") == 0)
-		return g_variant_new_object_path("/Menu");
-	
-	return NULL;
+	if(g_strcmp0(method_name, "Get") == 0) {
+		g_dbus_method_invocation_return_value(inv,
+			g_variant_new("(@a{sv})", stats_to_variant()));
+	} else if(g_strcmp0(method_name, "Reset") == 0) {
+		stats_reset();
+		g_dbus_method_invocation_return_value(inv, NULL);
+	} else if(g_strcmp0(method_name, "GetEvents") == 0)
+		g_dbus_method_invocation_return_value(inv, evlog_to_variant());
+}
+
+// (unread, new, accounts), as last announced
+static GVariant *build_counts(void) {
+	return g_variant_new("(uu@a{s(suu)})", published_unread, published_new,
+		published_accounts ? published_accounts
+			: g_variant_new_array(G_VARIANT_TYPE("{s(suu)}"), NULL, 0));
+}
+
+static void on_counts_method_call(GDBusConnection *conn, const gchar *sender,
+	const gchar *object_path, const gchar *iface, const gchar *method_name,
+	GVariant *params, GDBusMethodInvocation *inv, gpointer data)
+{
+	if(g_strcmp0(method_name, "GetCounts") == 0)
+		g_dbus_method_invocation_return_value(inv, build_counts());
 }
 
 static void on_snw_owner_changed(GDBusConnection *conn, const gchar *sender,
@@ -104,43 +316,101 @@ static void on_snw_owner_changed(GDBusConnection *conn, const gchar *sender,
 		register_with_watcher();
 }
 
-static void register_with_watcher(void) {
+static void on_watcher_registered(GObject *source,
+	GAsyncResult *res, gpointer data)
+{
 	GError *error = NULL;
+	GVariant *reply = g_dbus_connection_call_finish(
+		G_DBUS_CONNECTION(source), res, &error);
+	
+	guint64 *start = data;
+	stats_record(STATS_WATCHER_REGISTER, *start);
+	g_free(start);
 	
-	GDBusProxy *watcher_proxy = g_dbus_proxy_new_sync(bus, G_DBUS_PROXY_FLAGS_NONE,
-		NULL, "org.kde.StatusNotifierWatcher", "/StatusNotifierWatcher",
-		"org.kde.StatusNotifierWatcher", NULL, &error);
+	PROBE1(watcher_registered, (reply != NULL));
 	
-	if(!watcher_proxy) {
-		g_printerr("Evolution Tray: dbus: Failed to create proxy to "
-			"StatusNotifierWatcher: %s\n", error->message);
+	if(!reply) {
+		if(!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			report_error("Failed to register with StatusNotifierWatcher", error);
+		
 		g_clear_error(&error);
 		return;
 	}
 	
-	g_dbus_proxy_call_sync(watcher_proxy, "RegisterStatusNotifierItem",
-		g_variant_new("(s)", DBUS_SERVICE_NAME), G_DBUS_CALL_FLAGS_NONE,
-		-1, NULL, &error);
+	g_variant_unref(reply);
+}
+
+static void register_with_watcher(void) {
+	// For the roundtrip stats
+	guint64 *start = g_new(guint64, 1);
+	*start = stats_now();
 	
-	if(error) {
-		g_printerr("Evolution Tray: dbus: Failed to register with "
-			"StatusNotifierWatcher: %s\n", error->message);
-	}
+	PROBE(watcher_register);
 	
-	g_object_unref(watcher_proxy);
-	g_clear_error(&error);
+	g_dbus_connection_call(bus, SNW_BUS_NAME, SNW_OBJECT_PATH,
+		SNW_INTERFACE, "RegisterStatusNotifierItem",
+		g_variant_new("(s)", DBUS_SERVICE_NAME), NULL,
+		G_DBUS_CALL_FLAGS_NONE, SN_DBUS_TIMEOUT, cancellable,
+		on_watcher_registered, start);
 }
 
 // -----------------------------
 
 static action_enum_t manual_action;
 
+/* The folders with the most new mail, as last set, and the menu items
+ * currently showing them (plus a separator). The items are informational
+ * only, hence disabled. They are only rebuilt when the menu is about to
+ * be shown, and the list changed since. */
+static gchar **top_folders = NULL;
+static GPtrArray *top_folder_items = NULL;
+static gboolean top_folders_dirty = FALSE;
+
+static void update_top_folder_items(DbusmenuMenuitem *root) {
+	DbusmenuMenuitem *item;
+	
+	for(guint i = 0; i < top_folder_items->len; i++)
+		dbusmenu_menuitem_child_delete(root, top_folder_items->pdata[i]);
+	
+	g_ptr_array_set_size(top_folder_items, 0);
+	
+	if(!top_folders || !top_folders[0])
+		return;
+	
+	guint pos = 0;
+	
+	for(gchar **folder = top_folders; *folder; folder++) {
+		item = dbusmenu_menuitem_new();
+		
+		dbusmenu_menuitem_property_set(item,
+			DBUSMENU_MENUITEM_PROP_LABEL, *folder);
+		dbusmenu_menuitem_property_set_bool(item,
+			DBUSMENU_MENUITEM_PROP_ENABLED, FALSE);
+		
+		dbusmenu_menuitem_child_add_position(root, item, pos++);
+		g_ptr_array_add(top_folder_items, item);
+	}
+	
+	item = dbusmenu_menuitem_new();
+	
+	dbusmenu_menuitem_property_set(item,
+		DBUSMENU_MENUITEM_PROP_TYPE, DBUSMENU_CLIENT_TYPES_SEPARATOR);
+	
+	dbusmenu_menuitem_child_add_position(root, item, pos);
+	g_ptr_array_add(top_folder_items, item);
+}
+
 static gboolean on_menu_about_to_show(DbusmenuMenuitem *root, gpointer data) {
 	DbusmenuMenuitem *item = dbusmenu_menuitem_find_id(
 		root, MENU_MANUAL_ACTION_ITEM_ID);
 	
 	manual_action = tray_action(ACTION_QUERY);
 	
+	if(top_folders_dirty) {
+		update_top_folder_items(root);
+		top_folders_dirty = FALSE;
+	}
+	
 	gchar *label, *icon;
 	
 	if(manual_action <= ACTION_HIDE) {
@@ -180,6 +450,9 @@ static DbusmenuMenuitem *build_menu(void) {
 	
 	root = dbusmenu_menuitem_new();
 	
+	top_folder_items = g_ptr_array_new_with_free_func(g_object_unref);
+	top_folders_dirty = TRUE;
+	
 	g_signal_connect(root, DBUSMENU_MENUITEM_SIGNAL_ABOUT_TO_SHOW,
 		G_CALLBACK(on_menu_about_to_show), NULL);
 	
@@ -233,52 +506,125 @@ static DbusmenuMenuitem *build_menu(void) {
 	return root;
 }
 
-gint sn_init(const char *icon_name) {
-	GDBusProxy *bus_proxy = NULL;
-	GDBusNodeInfo *introspection_data = NULL;
-	GVariant *bus_reply = NULL;
+static void on_name_has_owner(GObject *source,
+	GAsyncResult *res, gpointer data)
+{
 	GError *error = NULL;
+	GVariant *reply = g_dbus_connection_call_finish(
+		G_DBUS_CONNECTION(source), res, &error);
 	
-	bus = NULL;
+	if(!reply) {
+		if(!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			report_error("NameHasOwner call failed", error);
+		
+		g_clear_error(&error);
+		return;
+	}
 	
-	gint return_code = -1;
+	gboolean watcher_available;
+	g_variant_get(reply, "(b)", &watcher_available);
+	g_variant_unref(reply);
 	
-	current_icon = icon_name;
+	if(watcher_available)
+		register_with_watcher();
+}
+
+/* Tear down whatever has been set up on the bus. Used both on fini, and
+ * when the asynchronous setup fails midway. */
+static void teardown(void) {
+	if(subscription_id > 0) {
+		g_dbus_connection_signal_unsubscribe(bus, subscription_id);
+		subscription_id = 0;
+	}
 	
-	// ---
+	g_clear_object(&menu_server);
+	g_clear_pointer(&top_folder_items, g_ptr_array_unref);
 	
-	bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
-	if(!bus) {
-		g_printerr("Evolution Tray: dbus: Failed to connect to D-Bus: %s\n",
-			error->message);
-		goto end;
+	if(counts_registration_id > 0) {
+		g_dbus_connection_unregister_object(bus, counts_registration_id);
+		counts_registration_id = 0;
 	}
 	
-	owner_id = g_bus_own_name_on_connection(bus, DBUS_SERVICE_NAME,
-		G_BUS_NAME_OWNER_FLAGS_NONE, NULL, NULL, NULL, NULL);
+	if(stats_registration_id > 0) {
+		g_dbus_connection_unregister_object(bus, stats_registration_id);
+		stats_registration_id = 0;
+	}
 	
-	/* Export SNI interface */
+	if(registration_id > 0) {
+		g_dbus_connection_unregister_object(bus, registration_id);
+		registration_id = 0;
+	}
+	
+	g_clear_handle_id(&owner_id, g_bus_unown_name);
+	g_clear_object(&bus);
+}
+
+static void on_bus_ready(GObject *source, GAsyncResult *res, gpointer data) {
+	GError *error = NULL;
 	
-	introspection_data = g_dbus_node_info_new_for_xml(introspection_xml, &error);
+	gint return_code = -1;
 	
-	if(!introspection_data) {
-		g_printerr("Evolution Tray: dbus: "
-			"Failed to parse introspection xml data: %s\n", error->message);
+	/* Careful: if cancelled, we might have already been fini'd and
+	 * re-init'd, so don't touch anything in that case. */
+	GDBusConnection *conn = g_bus_get_finish(res, &error);
+	if(!conn) {
+		if(g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			g_clear_error(&error);
+			return;
+		}
+		
+		report_error("Failed to connect to D-Bus", error);
 		goto end;
 	}
 	
+	bus = conn;
+	
+	owner_id = g_bus_own_name_on_connection(bus, DBUS_SERVICE_NAME,
+		G_BUS_NAME_OWNER_FLAGS_NONE, NULL, NULL, NULL, NULL);
+	
+	/* Export SNI interface. The interface info is generated at build
+	 * time from sn-dbus.xml, and is static; nothing to parse or free. */
+	
 	static const GDBusInterfaceVTable interface_vtable = {
 		.method_call = on_method_call,
-		.get_property = on_get_property
 	};
 	
 	registration_id = g_dbus_connection_register_object(bus,
-		SNI_OBJECT_PATH, introspection_data->interfaces[0],
+		SNI_OBJECT_PATH, (GDBusInterfaceInfo *) &status_notifier_item_interface,
 		&interface_vtable, NULL, NULL, &error);
 	
 	if(registration_id == 0) {
-		g_printerr("Evolution Tray: dbus: "
-			"Failed to register object: %s\n", error->message);
+		report_error("Failed to register object", error);
+		goto end;
+	}
+	
+	/* Export runtime stats */
+	
+	static const GDBusInterfaceVTable stats_vtable = {
+		.method_call = on_stats_method_call,
+	};
+	
+	stats_registration_id = g_dbus_connection_register_object(bus,
+		STATS_OBJECT_PATH, (GDBusInterfaceInfo *) &evolution_tray_stats_interface,
+		&stats_vtable, NULL, NULL, &error);
+	
+	if(stats_registration_id == 0) {
+		report_error("Failed to register stats object", error);
+		goto end;
+	}
+	
+	/* Export the mail counts */
+	
+	static const GDBusInterfaceVTable counts_vtable = {
+		.method_call = on_counts_method_call,
+	};
+	
+	counts_registration_id = g_dbus_connection_register_object(bus,
+		COUNTS_OBJECT_PATH, (GDBusInterfaceInfo *) &evolution_tray_counts_interface,
+		&counts_vtable, NULL, NULL, &error);
+	
+	if(counts_registration_id == 0) {
+		report_error("Failed to register counts object", error);
 		goto end;
 	}
 	
@@ -295,74 +641,257 @@ gint sn_init(const char *icon_name) {
 	
 	subscription_id = g_dbus_connection_signal_subscribe(bus,
 		"org.freedesktop.DBus", "org.freedesktop.DBus", "NameOwnerChanged",
-		"/org/freedesktop/DBus", "org.kde.StatusNotifierWatcher",
+		"/org/freedesktop/DBus", SNW_BUS_NAME,
 		G_DBUS_SIGNAL_FLAGS_NONE, on_snw_owner_changed, NULL, NULL);
 	
-	/* Create a proxy and check if a watcher already exists. If not, do
-	 * nothing -- we'll call register in the NameOwnerChanged callback. */
-	
-	bus_proxy = g_dbus_proxy_new_sync(bus, G_DBUS_PROXY_FLAGS_NONE,
-		NULL, "org.freedesktop.DBus", "/org/freedesktop/DBus",
-		"org.freedesktop.DBus", NULL, &error);
-	
-	if(!bus_proxy) {
-		g_printerr("Evolution Tray: dbus: "
-			"Failed to create DBus proxy: %s\n", error->message);
-		goto end;
-	}
+	/* Check if a watcher already exists. If not, do nothing --
+	 * we'll call register in the NameOwnerChanged callback. */
 	
-	bus_reply = g_dbus_proxy_call_sync(bus_proxy, "NameHasOwner",
-		g_variant_new("(s)", "org.kde.StatusNotifierWatcher"),
-		G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
-	
-	if(!bus_reply) {
-		g_printerr("Evolution Tray: dbus: "
-			"NameHasOwner call failed: %s\n", error->message);
-		goto end;
-	}
-	
-	gboolean watcher_available;
-	g_variant_get(bus_reply, "(b)", &watcher_available);
-	if(watcher_available)
-		register_with_watcher();
+	g_dbus_connection_call(bus, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+		"org.freedesktop.DBus", "NameHasOwner",
+		g_variant_new("(s)", SNW_BUS_NAME), G_VARIANT_TYPE("(b)"),
+		G_DBUS_CALL_FLAGS_NONE, SN_DBUS_TIMEOUT, cancellable,
+		on_name_has_owner, NULL);
 	
 	return_code = 0;
 	
 end:
 	
-	g_clear_object(&bus_proxy);
-	g_clear_pointer(&introspection_data, g_dbus_node_info_unref);
-	g_clear_pointer(&bus_reply, g_variant_unref);
 	g_clear_error(&error);
 	
 	if(return_code != 0)
-		sn_fini();
+		teardown();
+}
+
+/* Everything on the bus is set up asynchronously, so that a slow (or
+ * hung) bus or watcher can't stall Evolution's main thread. Failures are
+ * reported when they happen; there's no tray icon in that case, but the
+ * rest of the plugin keeps working. */
+void sn_init(const char *icon_name) {
+	current_icon = icon_name;
+	published_icon = icon_name;
+	
+	current_unread = current_new = 0;
+	published_unread = published_new = 0;
+	
+	g_clear_pointer(&current_details, g_free);
+	g_clear_pointer(&published_details, g_free);
+	
+	g_clear_pointer(&current_accounts, g_variant_unref);
+	g_clear_pointer(&published_accounts, g_variant_unref);
 	
-	return return_code;
+	g_clear_pointer(&top_folders, g_strfreev);
+	
+	for(sn_prop_t prop = 0; prop < SN_N_PROPS; prop++)
+		prop_quarks[prop] = g_quark_from_static_string(prop_names[prop]);
+	
+	cancellable = g_cancellable_new();
+	g_bus_get(G_BUS_TYPE_SESSION, cancellable, on_bus_ready, NULL);
 }
 
 void sn_fini(void) {
-	if(subscription_id > 0) {
-		g_dbus_connection_signal_unsubscribe(bus, subscription_id);
-		subscription_id = 0;
+	g_clear_handle_id(&update_timeout_id, g_source_remove);
+	pending_changes = 0;
+	
+	published_badge = 0;
+	badge_clear_cache();
+	
+	for(sn_prop_t prop = 0; prop < SN_N_PROPS; prop++)
+		invalidate_property(prop);
+	
+	// Abort any calls still in flight; their callbacks will ignore it
+	if(cancellable) {
+		g_cancellable_cancel(cancellable);
+		g_clear_object(&cancellable);
 	}
 	
-	g_clear_object(&menu_server);
+	teardown();
+}
+
+static guint current_badge(void) {
+	return (badge_enabled ? MIN(current_new, BADGE_MAX_COUNT + 1) : 0);
+}
+
+// Both NULL, or equal
+static gboolean accounts_equal(GVariant *a, GVariant *b) {
+	return (a == b || (a && b && g_variant_equal(a, b)));
+}
+
+static void publish_accounts(void) {
+	g_clear_pointer(&published_accounts, g_variant_unref);
 	
-	if(registration_id > 0) {
-		g_dbus_connection_unregister_object(bus, registration_id);
-		registration_id = 0;
+	if(current_accounts)
+		published_accounts = g_variant_ref(current_accounts);
+}
+
+static void emit_changes(void) {
+	guint changes = pending_changes;
+	pending_changes = 0;
+	
+	guint badge = current_badge();
+	
+	// Not (yet) on the bus, so there's no one to notify
+	if(!bus) {
+		invalidate_property(SN_PROP_ICON_NAME);
+		invalidate_property(SN_PROP_ICON_PIXMAP);
+		invalidate_property(SN_PROP_TITLE);
+		invalidate_property(SN_PROP_TOOLTIP);
+		
+		published_icon = current_icon;
+		published_badge = badge;
+		published_unread = current_unread;
+		published_new = current_new;
+		
+		g_free(published_details);
+		published_details = g_strdup(current_details);
+		
+		publish_accounts();
+		
+		return;
 	}
 	
-	g_clear_handle_id(&owner_id, g_bus_unown_name);
-	g_clear_object(&bus);
+	// The badge is part of the icon, so count changes may affect it too
+	if((changes & (SN_CHANGE_ICON | SN_CHANGE_COUNTS))
+		&& (current_icon != published_icon || badge != published_badge))
+	{
+		guint64 start = stats_now();
+		
+		published_icon = current_icon;
+		published_badge = badge;
+		
+		invalidate_property(SN_PROP_ICON_NAME);
+		invalidate_property(SN_PROP_ICON_PIXMAP);
+		
+		g_dbus_connection_emit_signal(bus, NULL, SNI_OBJECT_PATH,
+			SNI_INTERFACE, "NewIcon", NULL, NULL);
+		
+		stats_record(STATS_ICON_CHANGE, start);
+	}
+	
+	if(changes & SN_CHANGE_COUNTS) {
+		// The title only shows the new mail count
+		gboolean title_changed = (current_new != published_new);
+		gboolean tooltip_changed = (title_changed
+			|| current_unread != published_unread
+			|| g_strcmp0(current_details, published_details) != 0);
+		gboolean counts_changed = (title_changed
+			|| current_unread != published_unread
+			|| !accounts_equal(current_accounts, published_accounts));
+		
+		published_unread = current_unread;
+		published_new = current_new;
+		
+		if(tooltip_changed) {
+			g_free(published_details);
+			published_details = g_strdup(current_details);
+		}
+		
+		if(counts_changed) {
+			publish_accounts();
+			
+			g_dbus_connection_emit_signal(bus, NULL, COUNTS_OBJECT_PATH,
+				COUNTS_INTERFACE, "UnreadChanged", build_counts(), NULL);
+		}
+		
+		if(title_changed)
+			invalidate_property(SN_PROP_TITLE);
+		if(tooltip_changed)
+			invalidate_property(SN_PROP_TOOLTIP);
+		
+		if(title_changed) {
+			g_dbus_connection_emit_signal(bus, NULL, SNI_OBJECT_PATH,
+				SNI_INTERFACE, "NewTitle", NULL, NULL);
+		}
+		
+		if(tooltip_changed) {
+			g_dbus_connection_emit_signal(bus, NULL, SNI_OBJECT_PATH,
+				SNI_INTERFACE, "NewToolTip", NULL, NULL);
+		}
+	}
+}
+
+static gboolean on_update_timeout(gpointer data) {
+	update_timeout_id = 0;
+	emit_changes();
+	
+	return G_SOURCE_REMOVE;
+}
+
+static void queue_change(sn_change_t change) {
+	pending_changes |= change;
+	
+	if(update_interval == 0) {
+		emit_changes();
+		return;
+	}
+	
+	if(update_timeout_id == 0) {
+		update_timeout_id = g_timeout_add(update_interval,
+			on_update_timeout, NULL);
+	}
+}
+
+void sn_set_badge_enabled(gboolean enabled) {
+	badge_enabled = enabled;
+	queue_change(SN_CHANGE_ICON);
+}
+
+/* Minimum interval (ms) between change signals. 0 disables coalescing. */
+void sn_set_update_interval(guint interval_ms) {
+	update_interval = interval_ms;
 }
 
 void sn_set_icon(const gchar *icon_name) {
+	PROBE1(set_icon, icon_name);
+	evlog_add(EVLOG_ICON, 0, 0, icon_name);
+	
 	current_icon = icon_name;
+	queue_change(SN_CHANGE_ICON);
+}
+
+/* Mail counts for the Title and ToolTip. details, if not NULL, is
+ * appended to the ToolTip text (e.g. per-account breakdown). accounts, if
+ * not NULL, is the a{s(suu)} for the Counts interface; its floating
+ * reference is consumed. */
+void sn_set_counts(guint unread, guint new_mail,
+	const gchar *details, GVariant *accounts)
+{
+	if(accounts)
+		g_variant_ref_sink(accounts);
+	
+	if(unread == current_unread && new_mail == current_new
+		&& g_strcmp0(details, current_details) == 0
+		&& accounts_equal(accounts, current_accounts))
+	{
+		g_clear_pointer(&accounts, g_variant_unref);
+		return;
+	}
+	
+	current_unread = unread;
+	current_new = new_mail;
+	
+	g_free(current_details);
+	current_details = g_strdup(details);
+	
+	g_clear_pointer(&current_accounts, g_variant_unref);
+	current_accounts = accounts;
+	
+	queue_change(SN_CHANGE_COUNTS);
+}
+
+/* The folders with the most new mail, already formatted, most first. Shown
+ * at the top of the menu; NULL or empty for none. */
+void sn_set_top_folders(const gchar *const *folders) {
+	if(top_folders && folders
+			&& g_strv_equal(folders, (const gchar *const *) top_folders))
+		return;
+	
+	if(!top_folders && (!folders || !folders[0]))
+		return;
 	
-	g_dbus_connection_emit_signal(bus, NULL, SNI_OBJECT_PATH,
-		SNI_INTERFACE, "NewIcon", NULL, NULL);
+	g_strfreev(top_folders);
+	top_folders = (folders && folders[0] ? g_strdupv((gchar **) folders) : NULL);
+	top_folders_dirty = TRUE;
 }
 
 const gchar *sn_get_icon(void) {
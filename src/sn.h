@@ -5,10 +5,27 @@
 #define SNI_INTERFACE "org.kde.StatusNotifierItem"
 #define SNI_OBJECT_PATH "/StatusNotifierItem"
 
-int sn_init(const char *icon_name);
+#define COUNTS_INTERFACE "org.gnome.evolution.plugin.EvolutionTray.Counts"
+#define COUNTS_OBJECT_PATH "/Counts"
+
+#define SNW_BUS_NAME "org.kde.StatusNotifierWatcher"
+#define SNW_INTERFACE "org.kde.StatusNotifierWatcher"
+#define SNW_OBJECT_PATH "/StatusNotifierWatcher"
+
+// Timeout (ms) for our outgoing D-Bus calls
+#define SN_DBUS_TIMEOUT 5000
+
+#define SN_DEFAULT_UPDATE_INTERVAL 250
+
+void sn_init(const char *icon_name);
 
 void sn_fini(void);
+void sn_set_update_interval(guint interval_ms);
+void sn_set_badge_enabled(gboolean enabled);
 void sn_set_icon(const gchar *icon_name);
+void sn_set_counts(guint unread, guint new_mail,
+	const gchar *details, GVariant *accounts);
+void sn_set_top_folders(const gchar *const *folders);
 const gchar *sn_get_icon(void);
 
 #endif /* EVOLUTION_TRAY_SN_H */
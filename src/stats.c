@@ -0,0 +1,131 @@
+/* Evoution Tray plugin
+ *  Copyright (C) 2025 George Katevenis <george_kate@hotmail.com>
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Runtime statistics for the plugin's hot paths: a count and a latency
+ * histogram per metric. Recording is a handful of integer operations on a
+ * static array, so it's always on. Everything here runs on the main thread,
+ * hence no atomics.
+ *
+ * The activate-* metrics form a span, from the Activate call on the tray
+ * icon: activate-show is when the window was shown (or presented), after
+ * switching to the mail view if so; activate-action when the whole action
+ * is done, incl. acknowledging new mail; activate-frame when the window's
+ * first frame after that has been painted. The stats are exported on
+ * D-Bus by sn.c, e.g.:
+ *
+ * gdbus call --session --dest org.gnome.evolution.plugin.evolution-tray \
+ *   --object-path /Stats --method org.gnome.evolution.plugin.EvolutionTray.Stats.Get */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <gio/gio.h>
+#include <glib/gprintf.h>
+
+#include "stats.h"
+
+typedef struct stats_entry_t {
+	guint64 count;
+	guint64 sum_ns;
+	guint64 max_ns;
+	guint64 buckets[STATS_N_BUCKETS];
+} stats_entry_t;
+
+static stats_entry_t stats[STATS_N_METRICS];
+
+static const gchar *metric_names[STATS_N_METRICS] = {
+	[STATS_FOLDER_EVENT] = "folder-event",
+	[STATS_CHECKPOINT] = "checkpoint",
+	[STATS_ICON_CHANGE] = "icon-change",
+	[STATS_PROPERTY_GET] = "property-get",
+	[STATS_WATCHER_REGISTER] = "watcher-register",
+	[STATS_WINDOW_ACTION] = "window-action",
+	[STATS_ACTIVATE_SHOW] = "activate-show",
+	[STATS_ACTIVATE_ACTION] = "activate-action",
+	[STATS_ACTIVATE_FRAME] = "activate-frame",
+};
+
+// The current span, 0 if none, and its start
+static guint span_id = 0;
+static guint span_last_id = 0;
+static guint64 span_start = 0;
+
+void stats_record_ns(stats_metric_t metric, guint64 ns) {
+	stats_entry_t *e = &stats[metric];
+	
+	guint bucket = g_bit_storage(MIN(ns, G_MAXULONG)) - 1;
+	bucket = MIN(bucket, STATS_N_BUCKETS - 1);
+	
+	e->count++;
+	e->sum_ns += ns;
+	e->max_ns = MAX(e->max_ns, ns);
+	e->buckets[bucket]++;
+}
+
+// Ends the open span, if any, so that it can't be marked anymore
+guint stats_span_begin(void) {
+	if(++span_last_id == 0)
+		span_last_id = 1;
+	
+	span_id = span_last_id;
+	span_start = stats_now();
+	
+	return span_id;
+}
+
+// Record the time since the start of the span, if it's still open
+void stats_span_mark(guint span, stats_metric_t metric) {
+	if(span != 0 && span == span_id)
+		stats_record(metric, span_start);
+}
+
+void stats_span_end(guint span) {
+	if(span == span_id)
+		span_id = 0;
+}
+
+void stats_reset(void) {
+	memset(stats, 0, sizeof(stats));
+}
+
+/* a{sv}, one entry per metric, each an a{sv} with count, sum-ns, max-ns,
+ * and buckets (at, see STATS_N_BUCKETS). */
+GVariant *stats_to_variant(void) {
+	GVariantBuilder builder;
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+	
+	for(gint i = 0; i < STATS_N_METRICS; i++) {
+		GVariantDict dict;
+		g_variant_dict_init(&dict, NULL);
+		
+		g_variant_dict_insert(&dict, "count", "t", stats[i].count);
+		g_variant_dict_insert(&dict, "sum-ns", "t", stats[i].sum_ns);
+		g_variant_dict_insert(&dict, "max-ns", "t", stats[i].max_ns);
+		g_variant_dict_insert_value(&dict, "buckets",
+			g_variant_new_fixed_array(G_VARIANT_TYPE_UINT64, stats[i].buckets,
+				STATS_N_BUCKETS, sizeof(guint64)));
+		
+		g_variant_builder_add(&builder, "{sv}", metric_names[i],
+			g_variant_dict_end(&dict));
+	}
+	
+	return g_variant_builder_end(&builder);
+}
@@ -0,0 +1,51 @@
+#ifndef EVOLUTION_TRAY_STATS_H
+#define EVOLUTION_TRAY_STATS_H
+
+#include <time.h>
+
+#define STATS_INTERFACE "org.gnome.evolution.plugin.EvolutionTray.Stats"
+#define STATS_OBJECT_PATH "/Stats"
+
+/* Log2 buckets: bucket i holds durations in [2^i, 2^(i+1)) ns (bucket 0
+ * also holds 0 ns), and the last one holds everything above. */
+#define STATS_N_BUCKETS 32
+
+typedef enum {
+	STATS_FOLDER_EVENT,
+	STATS_CHECKPOINT,
+	STATS_ICON_CHANGE,
+	STATS_PROPERTY_GET,
+	STATS_WATCHER_REGISTER,
+	STATS_WINDOW_ACTION,
+	STATS_ACTIVATE_SHOW,
+	STATS_ACTIVATE_ACTION,
+	STATS_ACTIVATE_FRAME,
+	
+	STATS_N_METRICS
+} stats_metric_t;
+
+static inline guint64 stats_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (guint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void stats_record_ns(stats_metric_t metric, guint64 ns);
+
+// Record the time elapsed since start (from stats_now())
+static inline void stats_record(stats_metric_t metric, guint64 start) {
+	stats_record_ns(metric, stats_now() - start);
+}
+
+/* One span at a time, for the steps of a user-visible operation (a click
+ * on the tray icon); each step is recorded as the time since its start.
+ * Steps are marked with the id that stats_span_begin() returned, so that
+ * a late one can't land in a later span. */
+guint stats_span_begin(void);
+void stats_span_mark(guint span, stats_metric_t metric);
+void stats_span_end(guint span);
+
+void stats_reset(void);
+GVariant *stats_to_variant(void);
+
+#endif
@@ -0,0 +1,179 @@
+/* Evoution Tray plugin
+ *  Copyright (C) 2025 George Katevenis <george_kate@hotmail.com>
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Opt-in recorder of the events that drive the unread status: folder
+ * unread counts as we receive them from Evolution, and the points where
+ * the user acknowledged them. Enabled by pointing the EVOLUTION_TRAY_TRACE
+ * environment variable to the file to (over)write. The resulting trace can
+ * be replayed through ucount with bench/trace-replay, so that a user's
+ * problem (or load pattern) can be reproduced without their mailbox.
+ *
+ * See trace.h for the format. It's kept compact (varints, URIs interned
+ * once per file), as it may well be recording for a whole session. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include <gio/gio.h>
+#include <glib/gprintf.h>
+
+#include "trace.h"
+
+static FILE *trace_file = NULL;
+static GHashTable *folder_ids = NULL;
+static gint64 last_timestamp = 0;
+
+void trace_init(void) {
+	const gchar *path = g_getenv(TRACE_ENV_VAR);
+	
+	if(!path || !*path)
+		return;
+	
+	trace_file = fopen(path, "wb");
+	if(!trace_file) {
+		g_printerr("Evolution Tray: Failed to open trace file '%s'\n", path);
+		return;
+	}
+	
+	fwrite(TRACE_MAGIC, 1, 4, trace_file);
+	fputc(TRACE_VERSION, trace_file);
+	
+	folder_ids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	last_timestamp = g_get_monotonic_time();
+}
+
+void trace_fini(void) {
+	if(trace_file) {
+		fclose(trace_file);
+		trace_file = NULL;
+	}
+	
+	g_clear_pointer(&folder_ids, g_hash_table_destroy);
+}
+
+static void put_varint(guint64 v) {
+	while(v >= 0x80) {
+		fputc((v & 0x7f) | 0x80, trace_file);
+		v >>= 7;
+	}
+	
+	fputc(v, trace_file);
+}
+
+static void put_timestamp(void) {
+	gint64 now = g_get_monotonic_time();
+	
+	put_varint(now - last_timestamp);
+	last_timestamp = now;
+}
+
+static guint folder_id(const gchar *folder) {
+	gpointer value;
+	
+	if(g_hash_table_lookup_extended(folder_ids, folder, NULL, &value))
+		return GPOINTER_TO_UINT(value);
+	
+	guint id = g_hash_table_size(folder_ids);
+	gsize len = strlen(folder);
+	
+	g_hash_table_insert(folder_ids, g_strdup(folder), GUINT_TO_POINTER(id));
+	
+	fputc(TRACE_REC_FOLDER, trace_file);
+	put_varint(id);
+	put_varint(len);
+	fwrite(folder, 1, len, trace_file);
+	
+	return id;
+}
+
+void trace_folder_event(const gchar *folder, guint count) {
+	if(!trace_file)
+		return;
+	
+	guint id = folder_id(folder);
+	
+	fputc(TRACE_REC_EVENT, trace_file);
+	put_timestamp();
+	put_varint(id);
+	put_varint(count);
+}
+
+void trace_folder_removed(const gchar *folder) {
+	if(!trace_file)
+		return;
+	
+	guint id = folder_id(folder);
+	
+	fputc(TRACE_REC_REMOVE, trace_file);
+	put_timestamp();
+	put_varint(id);
+}
+
+void trace_folder_renamed(const gchar *old_folder, const gchar *new_folder) {
+	if(!trace_file)
+		return;
+	
+	guint old_id = folder_id(old_folder);
+	guint new_id = folder_id(new_folder);
+	
+	fputc(TRACE_REC_RENAME, trace_file);
+	put_timestamp();
+	put_varint(old_id);
+	put_varint(new_id);
+}
+
+static void put_uids(GPtrArray *uids) {
+	put_varint(uids ? uids->len : 0);
+	
+	for(guint i = 0; uids && i < uids->len; i++) {
+		const gchar *uid = g_ptr_array_index(uids, i);
+		gsize len = strlen(uid);
+		
+		put_varint(len);
+		fwrite(uid, 1, len, trace_file);
+	}
+}
+
+void trace_uids_changed(const gchar *folder, GPtrArray *added, GPtrArray *gone) {
+	if(!trace_file)
+		return;
+	
+	guint id = folder_id(folder);
+	
+	fputc(TRACE_REC_UIDS, trace_file);
+	put_timestamp();
+	put_varint(id);
+	put_uids(added);
+	put_uids(gone);
+}
+
+void trace_checkpoint(void) {
+	if(!trace_file)
+		return;
+	
+	fputc(TRACE_REC_CHECKPOINT, trace_file);
+	put_timestamp();
+	
+	/* Checkpoints are comparatively rare, and mark the points the user
+	 * cared about; make sure everything up to here is on disk. */
+	fflush(trace_file);
+}
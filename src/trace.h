@@ -0,0 +1,51 @@
+#ifndef EVOLUTION_TRAY_TRACE_H
+#define EVOLUTION_TRAY_TRACE_H
+
+/* Trace file format. All integers are unsigned LEB128 varints, unless
+ * noted otherwise. Timestamps are deltas, in microseconds, from the
+ * previous timestamped record (or from the start of the trace).
+ *
+ * Header: TRACE_MAGIC (4 bytes), TRACE_VERSION (1 byte)
+ *
+ * Records, each starting with a tag byte:
+ * - TRACE_REC_FOLDER: id, length, URI bytes (not NUL-terminated).
+ *   Interns the folder URI; ids are assigned sequentially from 0, and each
+ *   URI appears once per file, before its first event.
+ * - TRACE_REC_EVENT: dt, folder id, unread count
+ * - TRACE_REC_CHECKPOINT: dt
+ *   The unread counts were acknowledged (ucount_set_checkpoint()).
+ * - TRACE_REC_REMOVE: dt, folder id
+ *   The folder (or account) was removed (ucount_remove()).
+ * - TRACE_REC_RENAME: dt, old folder id, new folder id
+ *   The folder was renamed (ucount_rename()).
+ * - TRACE_REC_UIDS: dt, folder id, n added, n x (length, UID bytes),
+ *   n gone, n x (length, UID bytes)
+ *   Per-message changes of an open folder (ucount_uids_changed()).
+ *
+ * Version 1 traces are the same, without the REMOVE and RENAME records;
+ * version 2 ones without the UIDS records. */
+
+#define TRACE_ENV_VAR "EVOLUTION_TRAY_TRACE"
+
+#define TRACE_MAGIC "ETTR"
+#define TRACE_VERSION 3
+
+enum {
+	TRACE_REC_FOLDER = 1,
+	TRACE_REC_EVENT = 2,
+	TRACE_REC_CHECKPOINT = 3,
+	TRACE_REC_REMOVE = 4,
+	TRACE_REC_RENAME = 5,
+	TRACE_REC_UIDS = 6,
+};
+
+void trace_init(void);
+void trace_fini(void);
+
+void trace_folder_event(const gchar *folder, guint count);
+void trace_checkpoint(void);
+void trace_folder_removed(const gchar *folder);
+void trace_folder_renamed(const gchar *old_folder, const gchar *new_folder);
+void trace_uids_changed(const gchar *folder, GPtrArray *added, GPtrArray *gone);
+
+#endif
@@ -34,14 +34,39 @@
 #include <shell/e-shell-view.h>
 #include <shell/e-shell-window.h>
 #include <mail/em-event.h>
+#include <mail/e-mail-backend.h>
+#include <libemail-engine/libemail-engine.h>
 
 #include "tray.h"
 #include "sn.h"
 #include "ucount.h"
+#include "uqueue.h"
+#include "ufilter.h"
+#include "trace.h"
+#include "stats.h"
 #include "properties.h"
+#include "probes.h"
+#include "evlog.h"
+
+/* All of the shell windows, most recently focused first. The one at the
+ * head is where tray actions go; it's also kept in shell_window. Every
+ * window holds its own link (as object data), so that moving it to the head on
+ * focus, or dropping it when it's closed, is O(1). */
+static GQueue shell_windows = G_QUEUE_INIT;
+#define WINDOW_LINK_KEY "evolution-tray-link"
+
+// How many of the folders with the most new mail to list
+#define TOP_FOLDERS 5
 
 static EShellWindow *shell_window = NULL;
 
+static EMailSession *mail_session = NULL;
+static MailFolderCache *folder_cache = NULL;
+
+/* Open folders whose changes (per message) we follow, as a set. Only
+ * weak references; a folder leaves the set when it's finalized. */
+static GHashTable *watched_folders = NULL;
+
 static gboolean initialized = FALSE;
 static gboolean hide_startup = FALSE;
 
@@ -52,18 +77,145 @@ static enum {
 
 // -----------------------------
 
+// Hide to the tray, or show from it, all windows at once
 static void hide_window(void) {
-	gtk_widget_hide(GTK_WIDGET(shell_window));
+	for(GList *l = shell_windows.head; l; l = l->next)
+		gtk_widget_hide(GTK_WIDGET(l->data));
 }
 
 static void show_window(void) {
-	gtk_widget_show(GTK_WIDGET(shell_window));
+	// Most recently focused last, so that it ends up on top
+	for(GList *l = shell_windows.tail; l; l = l->prev)
+		gtk_widget_show(GTK_WIDGET(l->data));
+}
+
+typedef struct account_counts_t {
+	GString *details;
+	GVariantBuilder accounts;
+} account_counts_t;
+
+static void append_account_counts(const gchar *account,
+	guint unread, guint new_mail, gpointer data)
+{
+	account_counts_t *counts = data;
+	
+	// Account prefixes are 'folder://<source-uid>'
+	const gchar *uid = strstr(account, "://");
+	uid = (uid ? uid + 3 : account);
+	
+	ESourceRegistry *registry = e_shell_get_registry(e_shell_get_default());
+	ESource *source = e_source_registry_ref_source(registry, uid);
+	const gchar *name = (source ? e_source_get_display_name(source) : uid);
+	
+	g_variant_builder_add(&counts->accounts, "{s(suu)}",
+		uid, name, unread, new_mail);
+	
+	if(new_mail > 0) {
+		if(counts->details->len > 0)
+			g_string_append_c(counts->details, '\n');
+		
+		g_string_append_printf(counts->details, "%s: %u new", name, new_mail);
+	}
+	
+	g_clear_object(&source);
+}
+
+/* 'Account/Folder/Path' for a 'folder://<source-uid>/<escaped-path>' URI.
+ * Falls back to the URI as is, if it's not in that form. */
+static gchar *folder_label(const gchar *uri) {
+	const gchar *uid = strstr(uri, "://");
+	const gchar *path = (uid ? strchr(uid + 3, '/') : NULL);
+	
+	if(!path)
+		return g_strdup(uri);
+	
+	uid += 3;
+	
+	gchar *source_uid = g_strndup(uid, path - uid);
+	gchar *folder = g_uri_unescape_string(path + 1, NULL);
+	
+	ESourceRegistry *registry = e_shell_get_registry(e_shell_get_default());
+	ESource *source = e_source_registry_ref_source(registry, source_uid);
+	
+	gchar *label = g_strdup_printf("%s/%s", (source
+		? e_source_get_display_name(source) : source_uid),
+		(folder ? folder : path + 1));
+	
+	g_clear_object(&source);
+	g_free(folder);
+	g_free(source_uid);
+	
+	return label;
+}
+
+/* The ucount generation that the counts, details and top folders were last
+ * published for; G_MAXUINT64 if none yet. */
+static guint64 published_generation = G_MAXUINT64;
+
+/* Publish the current status and mail counts. The status itself may flip
+ * back and forth while a batch of folder events is being applied; only the
+ * final one goes out (see uqueue.c). This runs on every acknowledgement,
+ * so the rest is only re-built when the counts actually changed. */
+static void publish_state(void) {
+	const gchar *icon = (status == STATUS_UNREAD ? ICON_UNREAD : ICON_READ);
+	guint unread, new_mail;
+	
+	if(sn_get_icon() != icon)
+		sn_set_icon(icon);
+	
+	guint64 generation = ucount_get_generation();
+	
+	if(generation == published_generation)
+		return;
+	
+	published_generation = generation;
+	ucount_get_totals(&unread, &new_mail);
+	
+	/* Per-account breakdown of the new mail, if it spans several accounts.
+	 * The full per-account counts also go out on the Counts interface. */
+	account_counts_t counts = {.details = g_string_new(NULL)};
+	g_variant_builder_init(&counts.accounts, G_VARIANT_TYPE("a{s(suu)}"));
+	
+	ucount_foreach_account(append_account_counts, &counts);
+	
+	if(!strchr(counts.details->str, '\n'))
+		g_string_truncate(counts.details, 0);
+	
+	/* And the folders with the most new mail, in both the tooltip and
+	 * the menu. Only a few of them; the heap in ucount has them ready. */
+	const gchar *folders[TOP_FOLDERS];
+	guint folder_new[TOP_FOLDERS];
+	gchar *lines[TOP_FOLDERS + 1];
+	
+	guint n_folders = ucount_get_top_folders(TOP_FOLDERS, folders, folder_new);
+	
+	for(guint i = 0; i < n_folders; i++) {
+		gchar *label = folder_label(folders[i]);
+		lines[i] = g_strdup_printf("%s (%u new)", label, folder_new[i]);
+		g_free(label);
+		
+		if(counts.details->len > 0)
+			g_string_append_c(counts.details, '\n');
+		
+		g_string_append(counts.details, lines[i]);
+	}
+	
+	lines[n_folders] = NULL;
+	
+	sn_set_counts(unread, new_mail, (counts.details->len > 0
+		? counts.details->str : NULL), g_variant_builder_end(&counts.accounts));
+	sn_set_top_folders((const gchar *const *) lines);
+	
+	for(guint i = 0; i < n_folders; i++)
+		g_free(lines[i]);
+	
+	g_string_free(counts.details, TRUE);
 }
 
 static void set_read(gboolean set_checkpoint) {
 	if(status == STATUS_UNREAD) {
-		sn_set_icon(ICON_READ);
 		status = STATUS_READ;
+		evlog_add(EVLOG_STATUS, status, set_checkpoint, NULL);
 		
 		/* We are now in the 'read' status. The user now knows about
 		 * all new emails. Set this as our new known status. We'll only
@@ -76,8 +228,8 @@ static void set_read(gboolean set_checkpoint) {
 
 static void set_unread(void) {
 	if(status == STATUS_READ) {
-		sn_set_icon(ICON_UNREAD);
 		status = STATUS_UNREAD;
+		evlog_add(EVLOG_STATUS, status, FALSE, NULL);
 	}
 }
 
@@ -87,12 +239,110 @@ static void on_ucount_checkpoint(void) {
 	set_read(FALSE);
 }
 
+static void watch_folder(const gchar *uri);
+
+/* Apply a queued folder event to our internal per-folder unread count
+ * record. The icon is updated once the whole batch has been applied. */
+static void on_uqueue_event(const gchar *folder, guint count) {
+	gint delta = ucount_event(folder, count);
+	evlog_add(EVLOG_FOLDER_EVENT, count, delta, folder);
+	
+	if(delta > 0) {
+		set_unread();
+		
+		// From now on, hopefully also per message
+		watch_folder(folder);
+	}
+}
+
+static void on_uqueue_drained(void) {
+	publish_state();
+}
+
+/* The user is looking at the mail view. First make sure that all events
+ * that arrived before that are accounted for, then acknowledge them. */
+static void acknowledge(void) {
+	uqueue_flush();
+	
+	/* Recorded unconditionally, even though the checkpoint is only set when
+	 * in the 'unread' status. In the 'read' status, all folders are at their
+	 * checkpoint anyway, so replaying it as a checkpoint is equivalent. */
+	trace_checkpoint();
+	
+	set_read(TRUE);
+	publish_state();
+}
+
 static void switch_mail_view(void) {
 	e_shell_window_set_active_view(shell_window, "mail");
 }
 
-static gboolean in_mail_view(void) {
-	return g_str_equal(e_shell_window_get_active_view(shell_window), "mail");
+static gboolean in_mail_view(EShellWindow *window) {
+	return g_str_equal(e_shell_window_get_active_view(window), "mail");
+}
+
+// The span of the tray activation in progress, 0 if none
+static guint activate_span = 0;
+
+/* The frame clock of the window last shown by a tray activation, while
+ * waiting for its first frame to be painted; that ends the span. If none
+ * comes (e.g. the window is on another workspace), give up after a while. */
+static GdkFrameClock *frame_clock = NULL;
+static gulong frame_handler_id = 0;
+static guint frame_timeout_id = 0;
+static guint frame_span = 0;
+
+#define FRAME_WAIT_MS 2000
+
+static void unwatch_frame(void) {
+	if(frame_handler_id > 0) {
+		g_signal_handler_disconnect(frame_clock, frame_handler_id);
+		frame_handler_id = 0;
+	}
+	
+	g_clear_object(&frame_clock);
+	g_clear_handle_id(&frame_timeout_id, g_source_remove);
+	
+	frame_span = 0;
+}
+
+static void on_after_paint(GdkFrameClock *clock, gpointer data) {
+	stats_span_mark(frame_span, STATS_ACTIVATE_FRAME);
+	stats_span_end(frame_span);
+	
+	unwatch_frame();
+}
+
+static gboolean on_frame_timeout(gpointer data) {
+	frame_timeout_id = 0;
+	
+	stats_span_end(frame_span);
+	unwatch_frame();
+	
+	return G_SOURCE_REMOVE;
+}
+
+static void window_shown(void) {
+	if(activate_span == 0)
+		return;
+	
+	unwatch_frame();
+	stats_span_mark(activate_span, STATS_ACTIVATE_SHOW);
+	
+	GtkWidget *widget = GTK_WIDGET(shell_window);
+	GdkFrameClock *clock = gtk_widget_get_frame_clock(widget);
+	
+	if(!clock)
+		return;
+	
+	frame_span = activate_span;
+	frame_clock = g_object_ref(clock);
+	frame_handler_id = g_signal_connect(frame_clock, "after-paint",
+		G_CALLBACK(on_after_paint), NULL);
+	frame_timeout_id = g_timeout_add(FRAME_WAIT_MS, on_frame_timeout, NULL);
+	
+	// Make sure that there is a frame, even if nothing else changed
+	gtk_widget_queue_draw(widget);
 }
 
 static void do_action(action_enum_t action) {
@@ -101,6 +351,7 @@ static void do_action(action_enum_t action) {
 			switch_mail_view();
 		case ACTION_SHOW:
 			show_window();
+			window_shown();
 			break;
 		
 		case ACTION_HIDE:
@@ -109,12 +360,14 @@ static void do_action(action_enum_t action) {
 		
 		case ACTION_DEICONIFY:
 			gtk_window_deiconify(GTK_WINDOW(shell_window));
+			window_shown();
 			break;
 		
 		case ACTION_PRESENT:
 			gtk_window_present(GTK_WINDOW(shell_window));
+			window_shown();
 			switch_mail_view();
-			set_read(TRUE);
+			acknowledge();
 			break;
 		
 		default:
@@ -122,16 +375,11 @@ static void do_action(action_enum_t action) {
 	}
 }
 
-/* The 'ordinary' mode to use this method is to pass ACTION_AUTO; it
- * will just do the appropriate action according to the current state.
- * The alternative mode is to (1) call using ACTION_QUERY, which will
- * determine what action needs to be done, without actually doing it,
- * and (2) call using the returned action to actually do it. This is
- * helpful when determining the label for the manual hide/activate
- * menu item, to lock-in the desired action and ensure consistency
- * between the label and the actual action, since showing the menu
- * can alter the state. */
-action_enum_t tray_action(action_enum_t requested_action) {
+static action_enum_t run_action(action_enum_t requested_action) {
+	// No windows (left), e.g. while quitting
+	if(!shell_window)
+		return (requested_action < ACTION_AUTO ? requested_action : ACTION_SHOW);
+	
 	if(requested_action < ACTION_AUTO) {
 		do_action(requested_action);
 		return requested_action;
@@ -171,19 +419,72 @@ action_enum_t tray_action(action_enum_t requested_action) {
 	return action;
 }
 
+/* The 'ordinary' mode to use this method is to pass ACTION_AUTO; it
+ * will just do the appropriate action according to the current state.
+ * The alternative mode is to (1) call using ACTION_QUERY, which will
+ * determine what action needs to be done, without actually doing it,
+ * and (2) call using the returned action to actually do it. This is
+ * helpful when determining the label for the manual hide/activate
+ * menu item, to lock-in the desired action and ensure consistency
+ * between the label and the actual action, since showing the menu
+ * can alter the state. */
+action_enum_t tray_action(action_enum_t requested_action) {
+	guint64 start = stats_now();
+	PROBE1(action_start, requested_action);
+	
+	action_enum_t action = run_action(requested_action);
+	PROBE2(action_done, requested_action, action);
+	
+	if(requested_action != ACTION_QUERY) {
+		stats_record(STATS_WINDOW_ACTION, start);
+		evlog_add(EVLOG_WINDOW_ACTION, requested_action, action, NULL);
+	}
+	
+	return action;
+}
+
+/* A tray_action() for an activation of the tray icon (a click), timed as
+ * a span that lasts until the first frame of the window that it shows. */
+void tray_activate(action_enum_t requested_action) {
+	unwatch_frame();
+	activate_span = stats_span_begin();
+	
+	tray_action(requested_action);
+	stats_span_mark(activate_span, STATS_ACTIVATE_ACTION);
+	
+	// Unless a frame is still to come, that's the end of the span
+	if(frame_span != activate_span)
+		stats_span_end(activate_span);
+	
+	activate_span = 0;
+}
+
 void quit_evolution(void) {
 	e_shell_quit(e_shell_get_default(), E_SHELL_QUIT_ACTION);
 }
 
 // -----------------------------
 
+static gboolean other_window_visible(GtkWidget *widget) {
+	for(GList *l = shell_windows.head; l; l = l->next) {
+		if(l->data != widget && gtk_widget_get_visible(GTK_WIDGET(l->data)))
+			return TRUE;
+	}
+	
+	return FALSE;
+}
+
 static gboolean on_widget_deleted(GtkWidget *widget,
 	GdkEvent *event, gpointer data)
 {
-	/* If enabled, abort the window-close and hide it instead. */
+	/* If enabled, abort the window-close and hide it instead. Only for the
+	 * last visible window; closing any other one doesn't quit Evolution,
+	 * so let it close. */
+	
+	PROBE1(window_delete, widget);
 	
-	if(is_part_enabled(TRAY_SCHEMA, CONF_KEY_HIDE_ON_CLOSE)) {
-		hide_window();
+	if(tray_settings.hide_on_close && !other_window_visible(widget)) {
+		gtk_widget_hide(widget);
 		return TRUE; // we've handled it, don't run any more handlers
 	}
 	
@@ -204,12 +505,14 @@ static gboolean on_window_state_event(GtkWidget *widget,
 	 * all subsequently emitted events will have the WITHDRAWN flag, so just
 	 * ignore all invocations that contain it. */
 	
-	if(is_part_enabled(TRAY_SCHEMA, CONF_KEY_HIDE_ON_MINIMIZE)
+	PROBE2(window_state, widget, event->new_window_state);
+	
+	if(tray_settings.hide_on_minimize
 		&& (event->changed_mask & GDK_WINDOW_STATE_ICONIFIED)
 		&& (event->new_window_state & GDK_WINDOW_STATE_ICONIFIED)
 		&& !(event->new_window_state & GDK_WINDOW_STATE_WITHDRAWN))
 	{
-		hide_window();
+		gtk_widget_hide(widget);
 		gtk_window_deiconify(GTK_WINDOW(widget));
 	}
 	
@@ -217,27 +520,105 @@ static gboolean on_window_state_event(GtkWidget *widget,
 }
 
 static void on_window_show(GtkWidget *widget, gpointer data) {
+	PROBE1(window_show, widget);
+	
 	/* If enabled, the first time the evolution
 	 * window is shown, hide it to the tray. */
 	if(hide_startup) {
-		hide_window();
+		gtk_widget_hide(widget);
 		hide_startup = FALSE;
 	}
 	
-	if(in_mail_view())
-		set_read(TRUE);
+	if(in_mail_view(E_SHELL_WINDOW(widget)))
+		acknowledge();
 }
 
 static void on_window_focus_in(GtkWidget *widget,
 	GdkEventFocus *event, gpointer data)
 {
-	if(in_mail_view())
-		set_read(TRUE);
+	GList *link = g_object_get_data(G_OBJECT(widget), WINDOW_LINK_KEY);
+	
+	PROBE1(window_focus_in, widget);
+	
+	// Now the most recently focused
+	if(link && link != shell_windows.head) {
+		g_queue_unlink(&shell_windows, link);
+		g_queue_push_head_link(&shell_windows, link);
+		shell_window = link->data;
+	}
+	
+	if(in_mail_view(E_SHELL_WINDOW(widget)))
+		acknowledge();
 }
 
 static void on_active_view_change(EShellWindow *window) {
-	if(in_mail_view())
-		set_read(TRUE);
+	PROBE2(view_change, window, e_shell_window_get_active_view(window));
+	
+	if(in_mail_view(window))
+		acknowledge();
+}
+
+// -----------------------------
+
+static void track_window(EShellWindow *window) {
+	if(g_object_get_data(G_OBJECT(window), WINDOW_LINK_KEY))
+		return;
+	
+	GList *link = g_list_alloc();
+	link->data = window;
+	
+	g_queue_push_tail_link(&shell_windows, link);
+	g_object_set_data(G_OBJECT(window), WINDOW_LINK_KEY, link);
+	
+	shell_window = g_queue_peek_head(&shell_windows);
+	
+	g_signal_connect(G_OBJECT(window), "show",
+		G_CALLBACK(on_window_show), NULL);
+	
+	g_signal_connect(G_OBJECT(window), "focus-in-event",
+		G_CALLBACK(on_window_focus_in), NULL);
+	
+	g_signal_connect(G_OBJECT(window), "window-state-event",
+			G_CALLBACK(on_window_state_event), NULL);
+	
+	g_signal_connect(G_OBJECT(window), "delete-event",
+		G_CALLBACK(on_widget_deleted), NULL);
+	
+	g_signal_connect(G_OBJECT(window), "notify::active-view",
+		G_CALLBACK(on_active_view_change), NULL);
+}
+
+static void untrack_window(EShellWindow *window) {
+	GList *link = g_object_get_data(G_OBJECT(window), WINDOW_LINK_KEY);
+	
+	if(!link)
+		return;
+	
+	g_signal_handlers_disconnect_by_func(window, on_window_show, NULL);
+	g_signal_handlers_disconnect_by_func(window, on_window_focus_in, NULL);
+	g_signal_handlers_disconnect_by_func(window, on_window_state_event, NULL);
+	g_signal_handlers_disconnect_by_func(window, on_widget_deleted, NULL);
+	g_signal_handlers_disconnect_by_func(window, on_active_view_change, NULL);
+	
+	g_object_set_data(G_OBJECT(window), WINDOW_LINK_KEY, NULL);
+	g_queue_delete_link(&shell_windows, link);
+	
+	// The next most recently focused one takes over, if any
+	shell_window = g_queue_peek_head(&shell_windows);
+}
+
+static void on_window_added(GtkApplication *app,
+	GtkWindow *window, gpointer data)
+{
+	if(E_IS_SHELL_WINDOW(window))
+		track_window(E_SHELL_WINDOW(window));
+}
+
+static void on_window_removed(GtkApplication *app,
+	GtkWindow *window, gpointer data)
+{
+	if(E_IS_SHELL_WINDOW(window))
+		untrack_window(E_SHELL_WINDOW(window));
 }
 
 // -----------------------------
@@ -249,11 +630,206 @@ void org_gnome_mail_folder_unread_updated(EPlugin *ep,
 	if(t->unread == (guint) -1)
 		return;
 	
-	// Update our internal per-folder unread count record
-	gint delta = ucount_event(t->folder_uri, t->unread);
+	trace_folder_event(t->folder_uri, t->unread);
 	
-	if(delta > 0)
-		set_unread();
+	// Queued, and applied in batches along with any other pending events
+	uqueue_push(t->folder_uri, t->unread);
+}
+
+/* Folders that go away take their counts with them (so that e.g. deleting
+ * a folder with new mail resets the icon). Pending events are applied
+ * first, so that none of them re-creates the removed folder. */
+static void on_folder_deleted(MailFolderCache *cache, CamelStore *store,
+	const gchar *folder_name, gpointer data)
+{
+	gchar *uri = e_mail_folder_uri_build(store, folder_name);
+	
+	uqueue_flush();
+	
+	trace_folder_removed(uri);
+	ucount_remove(uri);
+	publish_state();
+	
+	g_free(uri);
+}
+
+static void on_folder_renamed(MailFolderCache *cache, CamelStore *store,
+	const gchar *old_folder_name, const gchar *new_folder_name, gpointer data)
+{
+	gchar *old_uri = e_mail_folder_uri_build(store, old_folder_name);
+	gchar *new_uri = e_mail_folder_uri_build(store, new_folder_name);
+	
+	uqueue_flush();
+	
+	trace_folder_renamed(old_uri, new_uri);
+	ucount_rename(old_uri, new_uri);
+	publish_state();
+	
+	g_free(old_uri);
+	g_free(new_uri);
+}
+
+static void on_source_removed(ESourceRegistry *registry,
+	ESource *source, gpointer data)
+{
+	if(!e_source_has_extension(source, E_SOURCE_EXTENSION_MAIL_ACCOUNT))
+		return;
+	
+	// Account prefixes are 'folder://<source-uid>'
+	gchar *uri = g_strconcat("folder://", e_source_get_uid(source), NULL);
+	
+	uqueue_flush();
+	
+	trace_folder_removed(uri);
+	ucount_remove(uri);
+	publish_state();
+	
+	g_free(uri);
+}
+
+/* The plugin isn't disabled on quit, so fini() doesn't run; save the
+ * counts (and the last checkpoint) now, rather than losing whatever
+ * changed since the last timed save. */
+static void on_prepare_for_quit(EShell *shell,
+	EActivity *activity, gpointer data)
+{
+	uqueue_flush();
+	ucount_save();
+}
+
+static EMailSession *find_mail_session(void) {
+	EShellBackend *backend = e_shell_get_backend_by_name(
+		e_shell_get_default(), "mail");
+	
+	if(!backend)
+		return NULL;
+	
+	return e_mail_backend_get_session(E_MAIL_BACKEND(backend));
+}
+
+// -----------------------------
+
+/* The messages that were added, removed, or changed in an open folder. This
+ * tells ucount exactly which mails are new, and which of them were read,
+ * rather than guess from the unread count alone (see ucount.c). */
+static void on_camel_folder_changed(CamelFolder *folder,
+	CamelFolderChangeInfo *info, gpointer data)
+{
+	const guint32 not_new = (CAMEL_MESSAGE_SEEN
+		| CAMEL_MESSAGE_DELETED | CAMEL_MESSAGE_JUNK);
+	
+	GPtrArray *uids;
+	
+	// Borrowed UIDs
+	GPtrArray *added = g_ptr_array_new();
+	GPtrArray *gone = g_ptr_array_new();
+	
+	uids = camel_folder_change_info_get_added_uids(info);
+	for(guint i = 0; uids && i < uids->len; i++) {
+		const gchar *uid = g_ptr_array_index(uids, i);
+		
+		if(!(camel_folder_get_message_flags(folder, uid) & not_new))
+			g_ptr_array_add(added, (gpointer) uid);
+	}
+	
+	uids = camel_folder_change_info_get_removed_uids(info);
+	for(guint i = 0; uids && i < uids->len; i++)
+		g_ptr_array_add(gone, g_ptr_array_index(uids, i));
+	
+	uids = camel_folder_change_info_get_changed_uids(info);
+	for(guint i = 0; uids && i < uids->len; i++) {
+		const gchar *uid = g_ptr_array_index(uids, i);
+		
+		if(camel_folder_get_message_flags(folder, uid) & not_new)
+			g_ptr_array_add(gone, (gpointer) uid);
+	}
+	
+	if(added->len > 0 || gone->len > 0) {
+		// From the folder itself; it may have been renamed since
+		gchar *uri = e_mail_folder_uri_from_folder(folder);
+		evlog_add(EVLOG_FOLDER_UIDS, added->len, gone->len, uri);
+		
+		/* Apply any pending count events first, so that ucount sees
+		 * (and the trace records) everything in order. */
+		uqueue_flush();
+		trace_uids_changed(uri, added, gone);
+		
+		if(ucount_uids_changed(uri, added, gone) > 0)
+			set_unread();
+		
+		publish_state();
+		g_free(uri);
+	}
+	
+	g_ptr_array_free(added, TRUE);
+	g_ptr_array_free(gone, TRUE);
+}
+
+static void on_watched_folder_finalized(gpointer data, GObject *folder) {
+	g_hash_table_remove(watched_folders, folder);
+}
+
+/* Follow the changes of a folder, if it's open. Folders that aren't open
+ * (e.g. only their counts are refreshed) don't report them, so they stay
+ * on counts alone; we try again the next time new mail arrives there. */
+static void watch_folder(const gchar *uri) {
+	CamelStore *store = NULL;
+	gchar *folder_name = NULL;
+	
+	if(!folder_cache || !e_mail_folder_uri_parse(CAMEL_SESSION(mail_session),
+			uri, &store, &folder_name, NULL))
+		return;
+	
+	CamelFolder *folder = mail_folder_cache_ref_folder(folder_cache,
+		store, folder_name);
+	
+	if(folder && !g_hash_table_contains(watched_folders, folder)) {
+		g_hash_table_add(watched_folders, folder);
+		g_object_weak_ref(G_OBJECT(folder), on_watched_folder_finalized, NULL);
+		
+		g_signal_connect(folder, "changed",
+			G_CALLBACK(on_camel_folder_changed), NULL);
+	}
+	
+	g_clear_object(&folder);
+	g_clear_object(&store);
+	g_free(folder_name);
+}
+
+static void unwatch_folders(void) {
+	GHashTableIter iter;
+	gpointer folder;
+	
+	g_hash_table_iter_init(&iter, watched_folders);
+	
+	while(g_hash_table_iter_next(&iter, &folder, NULL)) {
+		g_signal_handlers_disconnect_by_func(folder, on_camel_folder_changed, NULL);
+		g_object_weak_unref(G_OBJECT(folder), on_watched_folder_finalized, NULL);
+	}
+	
+	g_clear_pointer(&watched_folders, g_hash_table_destroy);
+}
+
+// -----------------------------
+
+static void on_settings_changed(const gchar *key) {
+	if(g_str_equal(key, CONF_KEY_ICON_UPDATE_INTERVAL))
+		sn_set_update_interval(tray_settings.icon_update_interval);
+	else if(g_str_equal(key, CONF_KEY_UNREAD_BADGE))
+		sn_set_badge_enabled(tray_settings.unread_badge);
+	else if(g_str_equal(key, CONF_KEY_MAX_FOLDERS)) {
+		ucount_set_max_folders(tray_settings.max_folders);
+		publish_state();
+	}
+	else if(g_str_equal(key, CONF_KEY_FOLDER_INCLUDE)
+		|| g_str_equal(key, CONF_KEY_FOLDER_EXCLUDE))
+	{
+		ufilter_compile((const gchar *const *) tray_settings.folder_include,
+			(const gchar *const *) tray_settings.folder_exclude);
+		
+		ucount_refilter();
+		publish_state();
+	}
 }
 
 // -----------------------------
@@ -272,69 +848,160 @@ static EShellWindow *find_shell_window(void) {
 	return NULL;
 }
 
-static gint init(void) {
+/* window is the one from e_plugin_ui_init(), if called from there. It
+ * might not have been added to the application yet. */
+static gint init(EShellWindow *window) {
 	gint err;
 	
 	/* When init() is called from e_plugin_lib_enable(), we might not have
 	 * otherwise obtained (i.e. in e_plugin_ui_init()) the shell window. */
-	if(!shell_window) {
-		if(!(shell_window = find_shell_window())) {
+	if(!window) {
+		if(!(window = find_shell_window())) {
 			g_printerr("Evolution Tray: Couldn't get the EShell Window. "
 				"At least not yet - this may not be fatal\n");
 			return -1;
 		}
 	}
 	
-	err = sn_init(ICON_READ);
+	err = properties_init(on_settings_changed);
 	if(err != 0) {
-		g_printerr("Evolution Tray: StatusNotifierItem init failed (%d)\n", err);
-		return -2;
+		g_printerr("Evolution Tray: Settings init failed (%d)\n", err);
+		return -5;
 	}
 	
-	err = ucount_init(on_ucount_checkpoint);
+	sn_set_update_interval(tray_settings.icon_update_interval);
+	sn_set_badge_enabled(tray_settings.unread_badge);
+	
+	ufilter_compile((const gchar *const *) tray_settings.folder_include,
+		(const gchar *const *) tray_settings.folder_exclude);
+	
+	// Can't fail here; bus errors are reported asynchronously
+	sn_init(ICON_READ);
+	
+	/* The counts are kept across restarts, so that mail that arrived
+	 * while Evolution was closed is still reported as new. */
+	gchar *snapshot = g_build_filename(e_get_user_cache_dir(),
+		"evolution-tray", "ucount.bin", NULL);
+	err = ucount_init(snapshot, on_ucount_checkpoint);
+	g_free(snapshot);
+	
 	if(err != 0) {
 		sn_fini();
+		ufilter_fini();
+		properties_fini();
 		g_printerr("Evolution Tray: Ucount init failed (%d)\n", err);
 		return -3;
 	}
 	
-	g_signal_connect(G_OBJECT(shell_window), "show",
-		G_CALLBACK(on_window_show), NULL);
+	ucount_set_max_folders(tray_settings.max_folders);
 	
-	g_signal_connect(G_OBJECT(shell_window), "focus-in-event",
-		G_CALLBACK(on_window_focus_in), NULL);
+	err = uqueue_init(on_uqueue_event, on_uqueue_drained);
+	if(err != 0) {
+		ucount_fini();
+		sn_fini();
+		ufilter_fini();
+		properties_fini();
+		g_printerr("Evolution Tray: Uqueue init failed (%d)\n", err);
+		return -4;
+	}
 	
-	g_signal_connect(G_OBJECT(shell_window), "window-state-event",
-			G_CALLBACK(on_window_state_event), NULL);
+	/* Enumerate the windows only this once; from here on, the
+	 * application tells us about the ones that come and go. */
+	GtkApplication *app = GTK_APPLICATION(e_shell_get_default());
 	
-	g_signal_connect(G_OBJECT(shell_window), "delete-event",
-		G_CALLBACK(on_widget_deleted), NULL);
+	track_window(window);
 	
-	g_signal_connect(G_OBJECT(shell_window), "notify::active-view",
-		G_CALLBACK(on_active_view_change), NULL);
+	for(GList *list = gtk_application_get_windows(app);
+		list != NULL; list = g_list_next(list))
+	{
+		if(E_IS_SHELL_WINDOW(list->data))
+			track_window(E_SHELL_WINDOW(list->data));
+	}
+	
+	g_signal_connect(app, "window-added",
+		G_CALLBACK(on_window_added), NULL);
+	
+	g_signal_connect(app, "window-removed",
+		G_CALLBACK(on_window_removed), NULL);
+	
+	watched_folders = g_hash_table_new(NULL, NULL);
+	
+	if((mail_session = find_mail_session())) {
+		g_object_ref(mail_session);
+		
+		folder_cache = e_mail_session_get_folder_cache(mail_session);
+		g_object_ref(folder_cache);
+		
+		g_signal_connect(folder_cache, "folder-deleted",
+			G_CALLBACK(on_folder_deleted), NULL);
+		
+		g_signal_connect(folder_cache, "folder-renamed",
+			G_CALLBACK(on_folder_renamed), NULL);
+	}
+	
+	g_signal_connect(e_shell_get_registry(e_shell_get_default()),
+		"source-removed", G_CALLBACK(on_source_removed), NULL);
+	
+	g_signal_connect(e_shell_get_default(), "prepare-for-quit",
+		G_CALLBACK(on_prepare_for_quit), NULL);
+	
+	trace_init();
 	
 	status = STATUS_READ;
 	initialized = TRUE;
 	
+	// New mail from the snapshot, not yet acknowledged last time
+	guint new_mail;
+	ucount_get_totals(NULL, &new_mail);
+	
+	if(new_mail > 0) {
+		set_unread();
+		publish_state();
+	}
+	
 	return 0;
 }
 
 static void fini(void) {
-	g_signal_handlers_disconnect_by_func(shell_window, on_window_show, NULL);
-	g_signal_handlers_disconnect_by_func(shell_window, on_window_focus_in, NULL);
-	g_signal_handlers_disconnect_by_func(shell_window, on_window_state_event, NULL);
-	g_signal_handlers_disconnect_by_func(shell_window, on_widget_deleted, NULL);
+	GtkApplication *app = GTK_APPLICATION(e_shell_get_default());
 	
-	g_signal_handlers_disconnect_by_func(shell_window, on_active_view_change, NULL);
+	g_signal_handlers_disconnect_by_func(app, on_window_added, NULL);
+	g_signal_handlers_disconnect_by_func(app, on_window_removed, NULL);
 	
+	if(folder_cache) {
+		g_signal_handlers_disconnect_by_func(folder_cache, on_folder_deleted, NULL);
+		g_signal_handlers_disconnect_by_func(folder_cache, on_folder_renamed, NULL);
+		g_clear_object(&folder_cache);
+	}
+	
+	unwatch_folders();
+	g_clear_object(&mail_session);
+	
+	g_signal_handlers_disconnect_by_func(e_shell_get_registry(
+		e_shell_get_default()), on_source_removed, NULL);
+	
+	g_signal_handlers_disconnect_by_func(e_shell_get_default(),
+		on_prepare_for_quit, NULL);
+	
+	// Apply what's still queued, so that it's in the snapshot
+	uqueue_flush();
+	
+	trace_fini();
+	uqueue_fini();
 	ucount_fini();
+	ufilter_fini();
 	sn_fini();
+	properties_fini();
 	
 	show_window();
+	unwatch_frame();
+	
+	while(shell_window)
+		untrack_window(shell_window);
 	
-	shell_window = NULL;
 	initialized = FALSE;
 	status = STATUS_READ;
+	published_generation = G_MAXUINT64;
 }
 
 #if EVOLUTION_VERSION < 35510
@@ -351,10 +1018,8 @@ gboolean e_plugin_ui_init(EUIManager *ui_manager, EShellView *shell_view) {
 	
 	gint err = 0;
 	
-	if(!initialized) {
-		shell_window = e_shell_view_get_shell_window(shell_view);
-		err = init();
-	}
+	if(!initialized)
+		err = init(e_shell_view_get_shell_window(shell_view));
 	
 	return (err == 0);
 }
@@ -363,7 +1028,7 @@ gint e_plugin_lib_enable(EPlugin *ep, gint enable) {
 	gint err = 0;
 	
 	if(enable && !initialized) {
-		err = init();
+		err = init(NULL);
 		
 		/* If init failed because we couldn't find the shell window, it
 		 * might be because it's not created yet. We did encounter this
@@ -18,6 +18,7 @@ typedef enum {
 } action_enum_t;
 
 action_enum_t tray_action(action_enum_t requested_action);
+void tray_activate(action_enum_t requested_action);
 void quit_evolution(void);
 
 #endif
@@ -28,6 +28,17 @@
  * When we receive an unread count event, we can compare with the entry
  * in the table to determine if there's a new email.
  *
+ * The table is a purpose-built one, since accounts may have tens of
+ * thousands of folders, and a GHashTable would need two allocations per
+ * folder (key + value) plus a pointer chase on every lookup. Instead:
+ * - The index is an open-addressing array (linear probing), where each slot
+ *   holds the cached hash of the key and the id of the entry. Probing only
+ *   compares the URI strings on a full hash match, and growing the index
+ *   never re-hashes the strings.
+ * - The entries themselves are stored as a struct-of-arrays, indexed by id
+ *   (count, checkpoint, key offset), with no per-folder allocation.
+ * - The URI strings are all stored back-to-back in a single arena.
+ *
  * We also want to know when emails have been read, so that we may undo
  * the 'unread' status, in scenarios where all new mails were read in
  * another client. This is also be achieved with the count entry (but
@@ -49,63 +60,1093 @@
  * each folder as its checkpoint, used to set the new acknowledged unread
  * counts per folder.
  *
- * Limitation: We only have per-folder, not per-email granularity. Therefore,
- * we can't know when the folder unread count decreases, if the email that
- * was read was a 'new' one and so we should go ahead and unset the 'unread'
- * status, or if it was an old one which the user already knows about, and
- * we should keep showing the 'unread' status. The current implementation
- * operates according to the 'new' scenario.
+ * Setting the checkpoint happens every time the user looks at the mail view
+ * (focus-in, show, view switch), so it must not walk the whole table. Each
+ * entry carries the epoch in which its checkpoint was last valid. Setting
+ * the checkpoint merely bumps the global epoch; an entry whose epoch is
+ * stale gets its checkpoint resolved (to the count it had at that moment,
+ * which is still its count, as it hasn't been touched since) the next time
+ * an event for it arrives. All folders are at their checkpoint right after
+ * it's set, so the global counter is simply reset to 0.
+ *
+ * We also keep running totals of the unread mails (sum of counts) and of
+ * the new mails (sum of count - checkpoint) over all folders, so that they
+ * can be shown without scanning the table. Each event adjusts them by the
+ * folder's delta, and setting the checkpoint zeroes the new mail total.
+ * Similarly, the folders with new mail are kept in a max-heap by their new
+ * mail count, so that the few with the most can be listed (e.g. in the
+ * tooltip) without sorting the table. Each entry knows its heap position,
+ * so an event costs O(log k), for k folders with new mail (usually a
+ * handful). Setting the checkpoint empties the heap in O(1): positions are
+ * only trusted if the heap slot they point to still holds the entry.
+ * The same totals are also kept per account and per folder branch, in a
+ * prefix tree over the folder URIs (see utree.c).
+ *
+ * Folders can be left out of all this with the include/exclude settings
+ * (see ufilter.c). Excluded folders still get an entry, but it's marked as
+ * such, on insertion, with the filter's verdict. Their events then cost a
+ * single lookup, and they're not part of the totals or the prefix tree.
+ * When the settings change, ucount_refilter() walks the table once.
+ *
+ * Folders also leave the table: when they're deleted or renamed (or their
+ * account is removed), and, if the table is capped, when it's full and they
+ * are the least recently updated ones. The entries are kept in LRU order in
+ * an intrusive list (prev/next arrays), so picking the one to evict is O(1).
+ * Removal shifts the rest of the probe run back into the freed slot (no
+ * tombstones), and moves the last entry into the freed id, so that the
+ * entry arrays stay dense. Dead keys stay in the arena until they make up
+ * half of it.
+ *
+ * The table is persisted across Evolution restarts, in a snapshot file in
+ * the user's cache dir. Otherwise, a folder's checkpoint would be seeded
+ * with whatever count we first see for it, and mail that arrived while
+ * Evolution was closed would never light the icon. The snapshot holds the
+ * entries in the same struct-of-arrays layout as in memory, along with
+ * their cached hashes and the key arena, so loading it is a single mmap()
+ * and a few bulk copies, with no re-hashing. It's written with an atomic
+ * rename, and at most once every USNAP_SAVE_DELAY seconds. Only building
+ * it in memory happens on the main thread; the write (which is fsync'd)
+ * happens in a worker, so that a large table can't stall the UI.
+ *
+ * Limitation: From the unread count events alone, we only have per-folder,
+ * not per-email granularity. Therefore, we can't know when the folder unread
+ * count decreases, if the email that was read was a 'new' one and so we
+ * should go ahead and unset the 'unread' status, or if it was an old one
+ * which the user already knows about, and we should keep showing the
+ * 'unread' status. Without more information, we go with the 'new' scenario.
+ *
+ * For folders that are open in Evolution, we do get more information: the
+ * UIDs of the messages added, removed or changed (ucount_uids_changed()).
+ * Such folders get a set of the UIDs of their new mails (see uidset.c),
+ * and their new mail count is the size of that set (bounded by the count),
+ * instead of count - checkpoint. Reading an old mail then leaves it as is.
+ * The checkpoint is still kept, as count - new, so that everything else
+ * (totals, tree, snapshot) works the same for all folders. The sets are
+ * cleared (lazily, along with the checkpoint) when the checkpoint is set.
+ * A folder only switches to its UID set when it's at its checkpoint, so
+ * that no new mail it had before that is lost. The sets are not part of
+ * the snapshot; after a restart, folders start over on counts alone.
  */
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include <gio/gio.h>
 #include <glib/gprintf.h>
 
 #include "ucount.h"
+#include "utree.h"
+#include "ufilter.h"
+#include "uidset.h"
+#include "stats.h"
+#include "probes.h"
 
-typedef struct unode_t {
-	guint count;
-	guint checkpoint;
-} unode_t;
+#define UTABLE_MIN_SLOTS 64
+#define UTABLE_MIN_ENTRIES 32
+#define UTABLE_MIN_ARENA 4096
+
+#define UTABLE_NONE G_MAXUINT32
 
-static GHashTable *utable = NULL;
+typedef struct uslot_t {
+	guint32 hash;
+	guint32 id; // entry id + 1; 0 means empty slot
+} uslot_t;
 
-// Current number of unodes where count > checkpoint
+typedef struct utable_t {
+	// Open-addressing index, n_slots is a power of 2
+	uslot_t *slots;
+	guint32 n_slots;
+	
+	// Entries (struct-of-arrays)
+	guint32 *key_offsets;
+	guint *counts;
+	guint *checkpoints;
+	guint32 *epochs;
+	guint32 *tree_nodes;
+	guint8 *excluded;
+	uidset_t **uidsets; // NULL unless tracked per message
+	guint32 *heap_pos;
+	guint32 n_entries;
+	guint32 entries_cap;
+	
+	// 0 for no limit
+	guint32 max_entries;
+	
+	// LRU list, most recently updated first
+	guint32 *lru_prev;
+	guint32 *lru_next;
+	guint32 lru_head;
+	guint32 lru_tail;
+	
+	// Max-heap of the ids of entries with new mail, by count - checkpoint
+	guint32 *heap;
+	guint32 heap_len;
+	
+	// Key arena, NUL-terminated URIs back-to-back
+	gchar *arena;
+	gsize arena_len;
+	gsize arena_cap;
+	gsize arena_garbage;
+} utable_t;
+
+static utable_t utable;
+static gboolean utable_initialized = FALSE;
+
+/* Current checkpoint epoch. An entry's checkpoint is only valid if its
+ * epoch matches this one; otherwise, it's equal to its count. */
+static guint32 checkpoint_epoch = 1;
+
+// Current number of entries where count > checkpoint
 static gint n_folders_over_checkpoint = 0;
 
+// Sum of count, and of (count - checkpoint), over all entries
+static guint total_unread = 0;
+static guint total_new = 0;
+
+/* Bumped on every change to the table (counts, checkpoints, folders), so
+ * that callers can tell whether anything they derived from it is stale.
+ * Not reset on fini, so that it's never mistaken for an earlier one. */
+static guint64 table_generation = 0;
+
 // Function to call when n_folders_over_checkpoint reaches 0
 static void (*global_checkpoint_reached_cb)(void) = NULL;
 
-gint ucount_init(void (*checkpoint_cb)(void)) {
-	utable = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
-	if(!utable) return -1;
+// -----------------------------
+
+#define USNAP_MAGIC "ETUC"
+#define USNAP_VERSION 1
+#define USNAP_SAVE_DELAY 30
+
+/* Followed by hashes[n], key_offsets[n], counts[n] and checkpoints[n], all
+ * 32-bit, and the key arena. Native endianness; it's merely a cache. */
+typedef struct usnap_header_t {
+	gchar magic[4];
+	guint32 version;
+	guint32 n_entries;
+	guint32 reserved;
+	guint64 arena_len;
+} usnap_header_t;
+
+static gchar *snapshot_path = NULL;
+static gboolean snapshot_dirty = FALSE;
+static guint snapshot_save_id = 0;
+
+// A built snapshot, to be written
+typedef struct usnap_write_t {
+	gchar *path;
+	GBytes *data;
+	guint64 generation;
+} usnap_write_t;
+
+static guint64 snapshot_generation = 0;
+static gboolean snapshot_in_flight = FALSE;
+
+/* Writes are serialized, and one that's older than the last written is
+ * dropped, so that an earlier snapshot never replaces a later one. */
+static GMutex snapshot_write_lock;
+static guint64 snapshot_written = 0;
+
+// -----------------------------
+
+// FNV-1a. Also yields the length of the key, which we need on insertion.
+static guint32 utable_hash(const gchar *key, gsize *len) {
+	guint32 hash = 2166136261u;
+	const gchar *p;
+	
+	for(p = key; *p; p++) {
+		hash ^= (guchar) *p;
+		hash *= 16777619u;
+	}
+	
+	*len = p - key;
+	return hash;
+}
+
+static inline const gchar *utable_key(guint32 id) {
+	return utable.arena + utable.key_offsets[id];
+}
+
+/* Returns the entry id, or -1 if not found. If slot_out is not NULL, it's
+ * set to the slot of the entry, or to the empty slot where it would go. */
+static gint64 utable_lookup(const gchar *key, guint32 hash, guint32 *slot_out) {
+	guint32 mask = utable.n_slots - 1;
+	guint32 slot = hash & mask;
+	
+	for(;; slot = (slot + 1) & mask) {
+		uslot_t *s = &utable.slots[slot];
+		
+		if(s->id == 0)
+			break;
+		
+		if(s->hash == hash && strcmp(utable_key(s->id - 1), key) == 0) {
+			if(slot_out) *slot_out = slot;
+			return s->id - 1;
+		}
+	}
+	
+	if(slot_out) *slot_out = slot;
+	return -1;
+}
+
+static void utable_grow_index(void) {
+	guint32 n_slots = utable.n_slots * 2;
+	guint32 mask = n_slots - 1;
+	uslot_t *slots = g_new0(uslot_t, n_slots);
+	
+	// Re-insert using the cached hashes; no need to touch the keys
+	for(guint32 i = 0; i < utable.n_slots; i++) {
+		uslot_t *s = &utable.slots[i];
+		if(s->id == 0) continue;
+		
+		guint32 slot = s->hash & mask;
+		while(slots[slot].id != 0)
+			slot = (slot + 1) & mask;
+		
+		slots[slot] = *s;
+	}
+	
+	g_free(utable.slots);
+	utable.slots = slots;
+	utable.n_slots = n_slots;
+}
+
+static void utable_grow_entries(void) {
+	guint32 cap = utable.entries_cap * 2;
+	
+	utable.key_offsets = g_renew(guint32, utable.key_offsets, cap);
+	utable.counts = g_renew(guint, utable.counts, cap);
+	utable.checkpoints = g_renew(guint, utable.checkpoints, cap);
+	utable.epochs = g_renew(guint32, utable.epochs, cap);
+	utable.tree_nodes = g_renew(guint32, utable.tree_nodes, cap);
+	utable.excluded = g_renew(guint8, utable.excluded, cap);
+	utable.uidsets = g_renew(uidset_t *, utable.uidsets, cap);
+	utable.heap_pos = g_renew(guint32, utable.heap_pos, cap);
+	utable.heap = g_renew(guint32, utable.heap, cap);
+	utable.lru_prev = g_renew(guint32, utable.lru_prev, cap);
+	utable.lru_next = g_renew(guint32, utable.lru_next, cap);
+	
+	utable.entries_cap = cap;
+}
+
+static void utable_reserve(guint32 n_entries, gsize arena_len) {
+	while(n_entries > utable.entries_cap)
+		utable_grow_entries();
+	
+	while((gsize) n_entries * 2 > utable.n_slots)
+		utable_grow_index();
+	
+	if(arena_len > utable.arena_cap) {
+		gsize cap = utable.arena_cap;
+		while(arena_len > cap)
+			cap *= 2;
+		
+		utable.arena = g_realloc(utable.arena, cap);
+		utable.arena_cap = cap;
+	}
+}
+
+static guint32 utable_arena_append(const gchar *key, gsize len) {
+	if(utable.arena_len + len + 1 > utable.arena_cap) {
+		gsize cap = utable.arena_cap * 2;
+		while(utable.arena_len + len + 1 > cap)
+			cap *= 2;
+		
+		utable.arena = g_realloc(utable.arena, cap);
+		utable.arena_cap = cap;
+	}
+	
+	guint32 offset = utable.arena_len;
+	memcpy(utable.arena + offset, key, len + 1);
+	utable.arena_len += len + 1;
+	
+	return offset;
+}
+
+static void utable_compact_arena(void) {
+	gchar *arena = g_malloc(utable.arena_cap);
+	gsize arena_len = 0;
+	
+	for(guint32 id = 0; id < utable.n_entries; id++) {
+		const gchar *key = utable_key(id);
+		gsize len = strlen(key) + 1;
+		
+		memcpy(arena + arena_len, key, len);
+		utable.key_offsets[id] = arena_len;
+		arena_len += len;
+	}
+	
+	g_free(utable.arena);
+	utable.arena = arena;
+	utable.arena_len = arena_len;
+	utable.arena_garbage = 0;
+}
+
+static void lru_unlink(guint32 id) {
+	guint32 prev = utable.lru_prev[id];
+	guint32 next = utable.lru_next[id];
+	
+	if(prev != UTABLE_NONE)
+		utable.lru_next[prev] = next;
+	else
+		utable.lru_head = next;
+	
+	if(next != UTABLE_NONE)
+		utable.lru_prev[next] = prev;
+	else
+		utable.lru_tail = prev;
+}
+
+static void lru_push_front(guint32 id) {
+	utable.lru_prev[id] = UTABLE_NONE;
+	utable.lru_next[id] = utable.lru_head;
+	
+	if(utable.lru_head != UTABLE_NONE)
+		utable.lru_prev[utable.lru_head] = id;
+	else
+		utable.lru_tail = id;
+	
+	utable.lru_head = id;
+}
+
+static inline void lru_touch(guint32 id) {
+	if(utable.lru_head != id) {
+		lru_unlink(id);
+		lru_push_front(id);
+	}
+}
+
+// -----------------------------
+
+static inline guint heap_key(guint32 id) {
+	return utable.counts[id] - utable.checkpoints[id];
+}
+
+static inline gboolean heap_contains(guint32 id) {
+	guint32 pos = utable.heap_pos[id];
+	return (pos < utable.heap_len && utable.heap[pos] == id);
+}
+
+static inline void heap_place(guint32 id, guint32 pos) {
+	utable.heap[pos] = id;
+	utable.heap_pos[id] = pos;
+}
+
+static void heap_sift_up(guint32 pos) {
+	guint32 id = utable.heap[pos];
+	guint key = heap_key(id);
+	
+	while(pos > 0) {
+		guint32 parent = (pos - 1) / 2;
+		
+		if(heap_key(utable.heap[parent]) >= key)
+			break;
+		
+		heap_place(utable.heap[parent], pos);
+		pos = parent;
+	}
+	
+	heap_place(id, pos);
+}
+
+static void heap_sift_down(guint32 pos) {
+	guint32 id = utable.heap[pos];
+	guint key = heap_key(id);
+	
+	for(;;) {
+		guint32 child = 2 * pos + 1;
+		
+		if(child >= utable.heap_len)
+			break;
+		
+		if(child + 1 < utable.heap_len && heap_key(utable.heap[child + 1])
+				> heap_key(utable.heap[child]))
+			child++;
+		
+		if(heap_key(utable.heap[child]) <= key)
+			break;
+		
+		heap_place(utable.heap[child], pos);
+		pos = child;
+	}
+	
+	heap_place(id, pos);
+}
+
+static void heap_remove(guint32 id) {
+	guint32 pos = utable.heap_pos[id];
+	guint32 last = utable.heap[--utable.heap_len];
+	
+	if(last != id) {
+		heap_place(last, pos);
+		heap_sift_up(pos);
+		heap_sift_down(utable.heap_pos[last]);
+	}
+}
+
+// The entry's new mail count changed; (re-)position it, or take it out
+static void heap_update(guint32 id) {
+	gboolean contained = heap_contains(id);
+	
+	if(heap_key(id) == 0) {
+		if(contained)
+			heap_remove(id);
+		return;
+	}
+	
+	if(!contained)
+		heap_place(id, utable.heap_len++);
+	
+	heap_sift_up(utable.heap_pos[id]);
+	heap_sift_down(utable.heap_pos[id]);
+}
+
+// -----------------------------
+
+// Move an entry to another (free) id, fixing up its slot and LRU links
+static void utable_move(guint32 from, guint32 to) {
+	const gchar *key = utable_key(from);
+	guint32 slot;
+	gsize len;
+	
+	utable_lookup(key, utable_hash(key, &len), &slot);
+	utable.slots[slot].id = to + 1;
+	
+	utable.key_offsets[to] = utable.key_offsets[from];
+	utable.counts[to] = utable.counts[from];
+	utable.checkpoints[to] = utable.checkpoints[from];
+	utable.epochs[to] = utable.epochs[from];
+	utable.tree_nodes[to] = utable.tree_nodes[from];
+	utable.excluded[to] = utable.excluded[from];
+	utable.uidsets[to] = utable.uidsets[from];
+	
+	if(heap_contains(from))
+		heap_place(to, utable.heap_pos[from]);
+	
+	guint32 prev = utable.lru_prev[from];
+	guint32 next = utable.lru_next[from];
+	
+	utable.lru_prev[to] = prev;
+	utable.lru_next[to] = next;
+	
+	if(prev != UTABLE_NONE)
+		utable.lru_next[prev] = to;
+	else
+		utable.lru_head = to;
+	
+	if(next != UTABLE_NONE)
+		utable.lru_prev[next] = to;
+	else
+		utable.lru_tail = to;
+}
+
+/* Remove an entry from the table. Only the table itself; see ucount_drop().
+ * The last entry takes its id, so ids are not stable across removals. */
+static void utable_remove(guint32 id) {
+	const gchar *key = utable_key(id);
+	guint32 mask = utable.n_slots - 1;
+	guint32 slot;
+	gsize len;
+	
+	utable_lookup(key, utable_hash(key, &len), &slot);
+	
+	/* Backward-shift deletion. Later entries of the probe run are moved
+	 * into the hole, unless their home slot is after it (cyclically). */
+	guint32 hole = slot;
+	
+	for(guint32 i = (hole + 1) & mask; utable.slots[i].id != 0; i = (i + 1) & mask) {
+		guint32 home = utable.slots[i].hash & mask;
+		
+		if(((i - home) & mask) >= ((i - hole) & mask)) {
+			utable.slots[hole] = utable.slots[i];
+			hole = i;
+		}
+	}
+	
+	utable.slots[hole] = (uslot_t) {0};
+	
+	lru_unlink(id);
+	uidset_free(utable.uidsets[id]);
+	utable.arena_garbage += len + 1;
+	
+	guint32 last = --utable.n_entries;
+	if(id != last)
+		utable_move(last, id);
+	
+	if(utable.arena_garbage > utable.arena_len / 2)
+		utable_compact_arena();
+}
+
+// -----------------------------
+
+// Resolve a checkpoint that was set lazily
+static inline void ucount_resolve(guint32 id) {
+	if(utable.epochs[id] != checkpoint_epoch) {
+		utable.checkpoints[id] = utable.counts[id];
+		utable.epochs[id] = checkpoint_epoch;
+		
+		if(utable.uidsets[id])
+			uidset_clear(utable.uidsets[id]);
+	}
+}
+
+/* Add the entry's counts to the totals and the prefix tree, according to
+ * the filter's verdict. Its epoch must be the current one. */
+static void ucount_attach(guint32 id) {
+	if(utable.excluded[id]) {
+		utable.checkpoints[id] = utable.counts[id];
+		utable.tree_nodes[id] = UTREE_ROOT;
+		return;
+	}
+	
+	guint count = utable.counts[id];
+	guint new_mail = count - utable.checkpoints[id];
+	
+	utable.tree_nodes[id] = utree_insert(utable_key(id));
+	utree_update(utable.tree_nodes[id], count, new_mail, checkpoint_epoch);
+	
+	total_unread += count;
+	total_new += new_mail;
+	
+	if(new_mail > 0) {
+		n_folders_over_checkpoint++;
+		heap_update(id);
+	}
+}
+
+/* The reverse. Returns whether this brought the folders over the checkpoint
+ * down to 0; it's up to the caller to invoke the callback (last). */
+static gboolean ucount_detach(guint32 id) {
+	if(utable.excluded[id])
+		return FALSE;
+	
+	ucount_resolve(id);
+	
+	guint count = utable.counts[id];
+	guint new_mail = count - utable.checkpoints[id];
+	
+	utree_update(utable.tree_nodes[id], -count, -new_mail, checkpoint_epoch);
+	utree_remove(utable.tree_nodes[id]);
+	
+	total_unread -= count;
+	total_new -= new_mail;
+	
+	if(new_mail > 0) {
+		heap_remove(id);
+		return (--n_folders_over_checkpoint == 0);
+	}
+	
+	return FALSE;
+}
+
+// -----------------------------
+
+// Insert a snapshot entry; we know that the key is not in the table
+static void snapshot_load_entry(guint32 hash) {
+	guint32 mask = utable.n_slots - 1;
+	guint32 slot = hash & mask;
+	
+	while(utable.slots[slot].id != 0)
+		slot = (slot + 1) & mask;
+	
+	guint32 id = utable.n_entries++;
+	utable.slots[slot] = (uslot_t) {.hash = hash, .id = id + 1};
+	utable.epochs[id] = checkpoint_epoch;
+	utable.uidsets[id] = NULL;
+	utable.heap_pos[id] = UTABLE_NONE;
+	
+	// Least recent first
+	lru_push_front(id);
+	
+	// The filter may have changed since the snapshot was saved
+	utable.excluded[id] = !ufilter_match(utable_key(id));
+	ucount_attach(id);
+}
+
+static void snapshot_load(void) {
+	struct stat st;
+	int fd;
+	
+	fd = open(snapshot_path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) return;
+	
+	if(fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(usnap_header_t)) {
+		close(fd);
+		return;
+	}
+	
+	gsize size = st.st_size;
+	const guchar *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	
+	if(map == MAP_FAILED) {
+		g_warning("Failed to map %s", snapshot_path);
+		return;
+	}
+	
+	const usnap_header_t *header = (const usnap_header_t *) map;
+	gsize n = header->n_entries;
+	gsize arrays_len = 4 * n * sizeof(guint32);
+	
+	// The arena must fill the rest of the file, and end with a NUL
+	if(memcmp(header->magic, USNAP_MAGIC, 4) != 0
+			|| header->version != USNAP_VERSION
+			|| arrays_len > size - sizeof(*header)
+			|| header->arena_len != size - sizeof(*header) - arrays_len
+			|| (header->arena_len > 0 && map[size - 1] != '\0')) {
+		g_warning("Ignoring invalid unread count snapshot %s", snapshot_path);
+		munmap((gpointer) map, size);
+		return;
+	}
+	
+	const guint32 *hashes = (const guint32 *) (map + sizeof(*header));
+	const guint32 *key_offsets = hashes + n;
+	const guint32 *counts = key_offsets + n;
+	const guint32 *checkpoints = counts + n;
+	const gchar *arena = (const gchar *) (checkpoints + n);
+	
+	for(gsize i = 0; i < n; i++) {
+		if(key_offsets[i] >= header->arena_len || checkpoints[i] > counts[i]) {
+			g_warning("Ignoring invalid unread count snapshot %s", snapshot_path);
+			munmap((gpointer) map, size);
+			return;
+		}
+	}
+	
+	utable_reserve(n, header->arena_len);
+	
+	memcpy(utable.arena, arena, header->arena_len);
+	memcpy(utable.key_offsets, key_offsets, n * sizeof(guint32));
+	memcpy(utable.counts, counts, n * sizeof(guint32));
+	memcpy(utable.checkpoints, checkpoints, n * sizeof(guint32));
+	utable.arena_len = header->arena_len;
+	
+	for(gsize i = 0; i < n; i++)
+		snapshot_load_entry(hashes[i]);
+	
+	munmap((gpointer) map, size);
+}
+
+/* The entries are written in LRU order, least recent first, so that loading
+ * them in order re-builds the list. The lazy checkpoints are resolved along
+ * the way, and the dead keys left out of the arena. */
+static GBytes *snapshot_build(void) {
+	guint32 n = utable.n_entries;
+	
+	gsize size = sizeof(usnap_header_t) + 4 * n * sizeof(guint32) + utable.arena_len;
+	guchar *buf = g_malloc(size);
+	
+	usnap_header_t *header = (usnap_header_t *) buf;
+	guint32 *hashes = (guint32 *) (buf + sizeof(*header));
+	guint32 *key_offsets = hashes + n;
+	guint32 *counts = key_offsets + n;
+	guint32 *checkpoints = counts + n;
+	gchar *arena = (gchar *) (checkpoints + n);
+	
+	guint32 *positions = g_new(guint32, MAX(n, 1));
+	guint32 i = 0;
+	
+	for(guint32 id = utable.lru_tail; id != UTABLE_NONE; id = utable.lru_prev[id])
+		positions[id] = i++;
+	
+	// The hashes are only found in the index
+	gsize arena_len = 0;
+	
+	for(guint32 s = 0; s < utable.n_slots; s++) {
+		if(utable.slots[s].id == 0) continue;
+		
+		guint32 id = utable.slots[s].id - 1;
+		const gchar *key = utable_key(id);
+		gsize len = strlen(key);
+		
+		i = positions[id];
+		
+		hashes[i] = utable.slots[s].hash;
+		key_offsets[i] = arena_len;
+		counts[i] = utable.counts[id];
+		checkpoints[i] = (utable.epochs[id] == checkpoint_epoch
+			? utable.checkpoints[id] : utable.counts[id]);
+		
+		memcpy(arena + arena_len, key, len + 1);
+		arena_len += len + 1;
+	}
+	
+	g_free(positions);
+	
+	*header = (usnap_header_t) {
+		.magic = USNAP_MAGIC,
+		.version = USNAP_VERSION,
+		.n_entries = n,
+		.arena_len = arena_len,
+	};
+	
+	return g_bytes_new_take(buf, size - (utable.arena_len - arena_len));
+}
+
+static usnap_write_t *snapshot_prepare(void) {
+	usnap_write_t *w = g_new(usnap_write_t, 1);
+	
+	w->path = g_strdup(snapshot_path);
+	w->data = snapshot_build();
+	w->generation = ++snapshot_generation;
 	
+	snapshot_dirty = FALSE;
+	return w;
+}
+
+static void snapshot_write_free(gpointer data) {
+	usnap_write_t *w = data;
+	
+	g_free(w->path);
+	g_bytes_unref(w->data);
+	g_free(w);
+}
+
+// From any thread
+static void snapshot_write(usnap_write_t *w) {
+	GError *error = NULL;
+	
+	g_mutex_lock(&snapshot_write_lock);
+	
+	if(w->generation > snapshot_written) {
+		gchar *dir = g_path_get_dirname(w->path);
+		g_mkdir_with_parents(dir, 0700);
+		g_free(dir);
+		
+		gsize len;
+		const gchar *data = g_bytes_get_data(w->data, &len);
+		
+		// Atomic (write to a temporary file, then rename over the old one)
+		if(g_file_set_contents_full(w->path, data, len,
+				G_FILE_SET_CONTENTS_CONSISTENT, 0600, &error))
+			snapshot_written = w->generation;
+		else {
+			g_warning("Failed to save unread count snapshot: %s", error->message);
+			g_error_free(error);
+		}
+	}
+	
+	g_mutex_unlock(&snapshot_write_lock);
+}
+
+static void snapshot_write_thread(GTask *task, gpointer source,
+	gpointer data, GCancellable *cancellable)
+{
+	snapshot_write(data);
+	g_task_return_boolean(task, TRUE);
+}
+
+static void snapshot_schedule(void);
+
+static void on_snapshot_written(GObject *source, GAsyncResult *res, gpointer data) {
+	snapshot_in_flight = FALSE;
+	
+	// Changed while it was being written; that's for the next one
+	if(snapshot_dirty)
+		snapshot_schedule();
+}
+
+/* Build the snapshot here, and write it in a worker. If the previous one
+ * is still being written, skip; on_snapshot_written() schedules another. */
+static void snapshot_save_async(void) {
+	if(snapshot_in_flight)
+		return;
+	
+	GTask *task = g_task_new(NULL, NULL, on_snapshot_written, NULL);
+	g_task_set_task_data(task, snapshot_prepare(), snapshot_write_free);
+	g_task_run_in_thread(task, snapshot_write_thread);
+	g_object_unref(task);
+	
+	snapshot_in_flight = TRUE;
+}
+
+// Right away, e.g. on fini, when there might be no main loop left to finish
+static void snapshot_save(void) {
+	usnap_write_t *w = snapshot_prepare();
+	
+	snapshot_write(w);
+	snapshot_write_free(w);
+}
+
+static gboolean on_snapshot_timeout(gpointer data) {
+	snapshot_save_id = 0;
+	snapshot_save_async();
+	
+	return G_SOURCE_REMOVE;
+}
+
+static void snapshot_schedule(void) {
+	if(snapshot_save_id == 0) {
+		snapshot_save_id = g_timeout_add_seconds(USNAP_SAVE_DELAY,
+			on_snapshot_timeout, NULL);
+	}
+}
+
+/* The table changed: that's a new generation, and the snapshot is to be
+ * saved, but not more often than USNAP_SAVE_DELAY. */
+static void snapshot_touch(void) {
+	table_generation++;
+	
+	if(!snapshot_path)
+		return;
+	
+	snapshot_dirty = TRUE;
+	snapshot_schedule();
+}
+
+// -----------------------------
+
+/* If snapshot_file is not NULL, the table is loaded from it (if it
+ * exists), and kept saved in it. */
+gint ucount_init(const gchar *snapshot_file, void (*checkpoint_cb)(void)) {
+	utable = (utable_t) {
+		.slots = g_new0(uslot_t, UTABLE_MIN_SLOTS),
+		.n_slots = UTABLE_MIN_SLOTS,
+		
+		.key_offsets = g_new(guint32, UTABLE_MIN_ENTRIES),
+		.counts = g_new(guint, UTABLE_MIN_ENTRIES),
+		.checkpoints = g_new(guint, UTABLE_MIN_ENTRIES),
+		.epochs = g_new(guint32, UTABLE_MIN_ENTRIES),
+		.tree_nodes = g_new(guint32, UTABLE_MIN_ENTRIES),
+		.excluded = g_new(guint8, UTABLE_MIN_ENTRIES),
+		.uidsets = g_new(uidset_t *, UTABLE_MIN_ENTRIES),
+		.heap_pos = g_new(guint32, UTABLE_MIN_ENTRIES),
+		.entries_cap = UTABLE_MIN_ENTRIES,
+		
+		.lru_prev = g_new(guint32, UTABLE_MIN_ENTRIES),
+		.lru_next = g_new(guint32, UTABLE_MIN_ENTRIES),
+		.lru_head = UTABLE_NONE,
+		.lru_tail = UTABLE_NONE,
+		
+		.heap = g_new(guint32, UTABLE_MIN_ENTRIES),
+		
+		.arena = g_malloc(UTABLE_MIN_ARENA),
+		.arena_cap = UTABLE_MIN_ARENA,
+	};
+	
+	utree_init();
+	
+	utable_initialized = TRUE;
 	global_checkpoint_reached_cb = checkpoint_cb;
 	
+	if(snapshot_file) {
+		snapshot_path = g_strdup(snapshot_file);
+		snapshot_load();
+	}
+	
 	return 0;
 }
 
+/* Write the snapshot now, if anything changed since the last one, rather
+ * than when the timer fires; e.g. when Evolution is about to quit. */
+void ucount_save(void) {
+	g_clear_handle_id(&snapshot_save_id, g_source_remove);
+	
+	if(snapshot_dirty)
+		snapshot_save();
+}
+
 void ucount_fini(void) {
-	g_clear_pointer(&utable, g_hash_table_destroy);
+	ucount_save();
+	g_clear_pointer(&snapshot_path, g_free);
+	
+	if(utable_initialized) {
+		for(guint32 id = 0; id < utable.n_entries; id++)
+			uidset_free(utable.uidsets[id]);
+		
+		g_free(utable.slots);
+		g_free(utable.key_offsets);
+		g_free(utable.counts);
+		g_free(utable.checkpoints);
+		g_free(utable.epochs);
+		g_free(utable.tree_nodes);
+		g_free(utable.excluded);
+		g_free(utable.uidsets);
+		g_free(utable.heap_pos);
+		g_free(utable.heap);
+		g_free(utable.lru_prev);
+		g_free(utable.lru_next);
+		g_free(utable.arena);
+		
+		utable = (utable_t) {0};
+		utable_initialized = FALSE;
+		
+		utree_fini();
+	}
+	
+	checkpoint_epoch = 1;
 	n_folders_over_checkpoint = 0;
+	total_unread = 0;
+	total_new = 0;
 	global_checkpoint_reached_cb = NULL;
 }
 
-static void ucount_insert(const gchar *folder, guint count) {
-	unode_t *unode = g_malloc(sizeof(unode_t));
-	gchar *key = g_strdup(folder);
+/* Take an entry out of the table, along with its counts. Returns whether
+ * this brought the folders over the checkpoint down to 0. */
+static gboolean ucount_drop(guint32 id) {
+	gboolean checkpoint_reached = ucount_detach(id);
 	
-	if(!unode || !key) {
-		g_free(unode);
-		g_free(key);
-		return;
+	utable_remove(id);
+	snapshot_touch();
+	
+	return checkpoint_reached;
+}
+
+static gboolean ucount_evict(guint32 n) {
+	gboolean checkpoint_reached = FALSE;
+	
+	for(; n > 0 && utable.lru_tail != UTABLE_NONE; n--)
+		checkpoint_reached |= ucount_drop(utable.lru_tail);
+	
+	return checkpoint_reached;
+}
+
+/* Returns whether making room for the new entry brought the folders over
+ * the checkpoint down to 0 (and they still are). */
+static gboolean ucount_insert(const gchar *folder, gsize len,
+	guint32 hash, guint32 slot, guint count, guint checkpoint)
+{
+	gboolean checkpoint_reached = FALSE;
+	
+	// Evict the least recently updated, if full
+	if(utable.max_entries > 0 && utable.n_entries >= utable.max_entries) {
+		checkpoint_reached = ucount_evict(
+			utable.n_entries - utable.max_entries + 1);
+		
+		utable_lookup(folder, hash, &slot);
+	}
+	
+	/* Keep the load factor under 1/2. The index is re-built on growth,
+	 * so the slot we got from the lookup needs to be found again. */
+	if((utable.n_entries + 1) * 2 > utable.n_slots) {
+		utable_grow_index();
+		utable_lookup(folder, hash, &slot);
+	}
+	
+	if(utable.n_entries == utable.entries_cap)
+		utable_grow_entries();
+	
+	guint32 id = utable.n_entries++;
+	
+	utable.key_offsets[id] = utable_arena_append(folder, len);
+	utable.counts[id] = count;
+	utable.checkpoints[id] = checkpoint;
+	utable.epochs[id] = checkpoint_epoch;
+	utable.uidsets[id] = NULL;
+	utable.heap_pos[id] = UTABLE_NONE;
+	
+	utable.slots[slot] = (uslot_t) {.hash = hash, .id = id + 1};
+	lru_push_front(id);
+	
+	snapshot_touch();
+	
+	// Evaluate the filter once, and remember the verdict
+	utable.excluded[id] = !ufilter_match(folder);
+	ucount_attach(id);
+	
+	return (checkpoint_reached && n_folders_over_checkpoint == 0);
+}
+
+// New mail of a folder tracked per message, if its count were count
+static inline guint tracked_new(guint32 id, guint count) {
+	return MIN(uidset_size(utable.uidsets[id]), count);
+}
+
+/* Set an (included, resolved) entry's count and checkpoint, and adjust the
+ * totals and the prefix tree accordingly. Returns whether this brought the
+ * folders over the checkpoint down to 0; the callback is up to the caller. */
+static gboolean ucount_apply(guint32 id, guint count, guint checkpoint) {
+	guint prev_count = utable.counts[id];
+	guint prev_new = prev_count - utable.checkpoints[id];
+	guint new_mail = count - checkpoint;
+	
+	if(count == prev_count && new_mail == prev_new)
+		return FALSE;
+	
+	utable.counts[id] = count;
+	utable.checkpoints[id] = checkpoint;
+	
+	snapshot_touch();
+	
+	total_unread += count - prev_count;
+	total_new += new_mail - prev_new;
+	
+	utree_update(utable.tree_nodes[id], count - prev_count,
+		new_mail - prev_new, checkpoint_epoch);
+	
+	if(new_mail != prev_new)
+		heap_update(id);
+	
+	// if was at checkpoint, and now aren't
+	if(prev_new == 0 && new_mail > 0)
+		n_folders_over_checkpoint++;
+	
+	// if wasn't at checkpoint, but now are
+	if(prev_new > 0 && new_mail == 0)
+		return (--n_folders_over_checkpoint == 0);
+	
+	return FALSE;
+}
+
+static gint ucount_update(const gchar *folder, guint count) {
+	gsize len;
+	guint32 slot;
+	
+	guint32 hash = utable_hash(folder, &len);
+	gint64 id = utable_lookup(folder, hash, &slot);
+	
+	if(id < 0) {
+		if(ucount_insert(folder, len, hash, slot, count, count))
+			global_checkpoint_reached_cb();
+		
+		return 0;
+	}
+	
+	lru_touch(id);
+	
+	/* Keep the count current, so that it's accurate if the folder gets
+	 * included later, but no more than that. */
+	if(G_UNLIKELY(utable.excluded[id])) {
+		if(utable.counts[id] != count)
+			snapshot_touch();
+		
+		utable.counts[id] = count;
+		utable.checkpoints[id] = count;
+		return 0;
+	}
+	
+	ucount_resolve(id);
+	
+	guint prev_count = utable.counts[id];
+	guint prev_new = prev_count - utable.checkpoints[id];
+	guint checkpoint;
+	
+	if(utable.uidsets[id])
+		checkpoint = count - tracked_new(id, count);
+	else {
+		/* Can't have count < checkpoint. A read mail that takes the count
+		 * under it counts as a new one (see the limitation above). */
+		checkpoint = MIN(utable.checkpoints[id], count);
 	}
 	
-	*unode = (unode_t) {.count = count, .checkpoint = count};
-	g_hash_table_insert(utable, key, unode);
+	// Last, so that the callback sees consistent state
+	if(ucount_apply(id, count, checkpoint))
+		global_checkpoint_reached_cb();
+	
+	/* Is the new count higher than the previous one? The same? The
+	 * negative count is not all that useful, be careful interpreting it.
+	 * For folders tracked per message, it's the new mail count instead;
+	 * more unread mail doesn't mean new mail, until we see its UID. */
+	if(utable.uidsets[id])
+		return (count - checkpoint) - prev_new;
+	
+	return count - prev_count;
 }
 
 /* New information regarding the unread count of a folder.
@@ -113,52 +1154,311 @@ static void ucount_insert(const gchar *folder, guint count) {
  * - Check against our known checkpoint, and update the global record.
  * - If the global record drops to 0, invoke the callback.  */
 gint ucount_event(const gchar *folder, guint count) {
-	unode_t *unode = g_hash_table_lookup(utable, folder);
+	guint64 start = stats_now();
+	gint delta = ucount_update(folder, count);
+	
+	stats_record(STATS_FOLDER_EVENT, start);
+	PROBE3(folder_event, folder, count, delta);
+	
+	return delta;
+}
+
+static gint ucount_update_uids(const gchar *folder,
+	GPtrArray *added, GPtrArray *gone)
+{
+	gsize len;
+	guint32 slot;
 	
-	if(!unode) {
-		ucount_insert(folder, count);
+	guint32 hash = utable_hash(folder, &len);
+	gint64 id = utable_lookup(folder, hash, &slot);
+	
+	/* Not seen yet, so it's at its checkpoint. Its count will come with
+	 * its own event; until then, the new mail can't be more than 0. */
+	if(id < 0) {
+		if(!added || added->len == 0)
+			return 0;
+		
+		if(ucount_insert(folder, len, hash, slot, 0, 0))
+			global_checkpoint_reached_cb();
+		
+		id = utable.n_entries - 1;
+	}
+	
+	lru_touch(id);
+	
+	if(G_UNLIKELY(utable.excluded[id]))
 		return 0;
+	
+	ucount_resolve(id);
+	
+	guint count = utable.counts[id];
+	guint prev_new = count - utable.checkpoints[id];
+	
+	// Switch over only from the checkpoint; see above
+	if(!utable.uidsets[id]) {
+		if(prev_new > 0)
+			return 0;
+		
+		utable.uidsets[id] = uidset_new();
 	}
 	
-	guint prev_count = unode->count;
-	gboolean was_at_checkpoint = (prev_count == unode->checkpoint);
+	for(guint i = 0; added && i < added->len; i++)
+		uidset_add(utable.uidsets[id], g_ptr_array_index(added, i));
+	
+	for(guint i = 0; gone && i < gone->len; i++)
+		uidset_remove(utable.uidsets[id], g_ptr_array_index(gone, i));
+	
+	guint new_mail = tracked_new(id, count);
+	
+	if(ucount_apply(id, count, count - new_mail))
+		global_checkpoint_reached_cb();
 	
-	unode->count = count;
+	return new_mail - prev_new;
+}
+
+/* Per-message information for a folder: the UIDs of messages that arrived
+ * unread (added), and of those that were read or removed (gone). Either may
+ * be NULL. Returns the change in the folder's new mail count. */
+gint ucount_uids_changed(const gchar *folder, GPtrArray *added, GPtrArray *gone) {
+	guint64 start = stats_now();
+	gint delta = ucount_update_uids(folder, added, gone);
+	
+	stats_record(STATS_FOLDER_EVENT, start);
+	PROBE3(uids_changed, folder, (added ? added->len : 0), delta);
+	
+	return delta;
+}
+
+/* Set the current count of every folder as its checkpoint. This is done
+ * lazily, see above. Only on the (very unlikely) wrap-around of the epoch
+ * do we have to walk the table, as stale epochs could then alias. */
+void ucount_set_checkpoint(void) {
+	guint64 start = stats_now();
 	
-	if(count > prev_count) {
+	if(++checkpoint_epoch == 0) {
+		memcpy(utable.checkpoints, utable.counts,
+			utable.n_entries * sizeof(*utable.checkpoints));
 		
-		// if was at checkpoint, and now aren't
-		if(was_at_checkpoint)
-			n_folders_over_checkpoint++;
+		checkpoint_epoch = 1;
+		for(guint32 i = 0; i < utable.n_entries; i++) {
+			utable.epochs[i] = checkpoint_epoch;
 			
-	} else if(count < prev_count) {
-		if(count <= unode->checkpoint) {
-			// can't have count < checkpoint
-			unode->checkpoint = count;
-			
-			// if wasn't at checkpoint, but now are
-			if(!was_at_checkpoint) {
-				n_folders_over_checkpoint--;
-				
-				if(n_folders_over_checkpoint == 0)
-					global_checkpoint_reached_cb();
-			}
+			if(utable.uidsets[i])
+				uidset_clear(utable.uidsets[i]);
 		}
+		
+		utree_reset_new(checkpoint_epoch);
 	}
 	
-	/* Is the new count higher than the previous one? The same? The
-	 * negative count is not all that useful, be careful interpreting it. */
-	return count - prev_count;
+	n_folders_over_checkpoint = 0;
+	total_new = 0;
+	utable.heap_len = 0;
+	
+	snapshot_touch();
+	
+	stats_record(STATS_CHECKPOINT, start);
+	PROBE1(checkpoint, checkpoint_epoch);
 }
 
-static void set_checkpoint_foreach_cb(gpointer key, gpointer value,
-	gpointer user_data)
+/* Re-evaluate the filter for every folder, after it's been changed.
+ * Newly included folders start at their checkpoint; their unread mail
+ * was never reported, so we can't tell how much of it is new. */
+void ucount_refilter(void) {
+	gboolean was_over = (n_folders_over_checkpoint > 0);
+	
+	for(guint32 id = 0; id < utable.n_entries; id++) {
+		gboolean excluded = !ufilter_match(utable_key(id));
+		
+		if(excluded == utable.excluded[id])
+			continue;
+		
+		if(excluded) {
+			ucount_detach(id);
+			g_clear_pointer(&utable.uidsets[id], uidset_free);
+			utable.excluded[id] = TRUE;
+			utable.checkpoints[id] = utable.counts[id];
+		} else {
+			utable.excluded[id] = FALSE;
+			utable.checkpoints[id] = utable.counts[id];
+			utable.epochs[id] = checkpoint_epoch;
+			ucount_attach(id);
+		}
+	}
+	
+	snapshot_touch();
+	
+	if(was_over && n_folders_over_checkpoint == 0)
+		global_checkpoint_reached_cb();
+}
+
+// Whether key is the folder itself, or a folder under it
+static inline gboolean in_subtree(const gchar *key,
+	const gchar *folder, gsize folder_len)
 {
-	unode_t *unode = (unode_t *) value;
-	unode->checkpoint = unode->count;
+	return (strncmp(key, folder, folder_len) == 0
+		&& (key[folder_len] == '\0' || key[folder_len] == '/'));
 }
 
-void ucount_set_checkpoint(void) {
-	g_hash_table_foreach(utable, set_checkpoint_foreach_cb, NULL);
-	n_folders_over_checkpoint = 0;
+/* A folder was deleted, along with any folders under it. Also works for a
+ * whole account, with its URI prefix (e.g. 'folder://account-uid'). */
+void ucount_remove(const gchar *folder) {
+	gsize folder_len = strlen(folder);
+	gboolean checkpoint_reached = FALSE;
+	
+	// Backwards, as a removal moves the last entry into the freed id
+	for(guint32 id = utable.n_entries; id-- > 0;) {
+		if(in_subtree(utable_key(id), folder, folder_len))
+			checkpoint_reached |= ucount_drop(id);
+	}
+	
+	if(checkpoint_reached)
+		global_checkpoint_reached_cb();
+}
+
+typedef struct urename_t {
+	gchar *key;
+	guint count;
+	guint checkpoint;
+} urename_t;
+
+/* A folder was renamed (or moved), along with any folders under it. Their
+ * counts and checkpoints carry over to the new URIs. */
+void ucount_rename(const gchar *old_folder, const gchar *new_folder) {
+	gsize old_len = strlen(old_folder);
+	gboolean checkpoint_reached = FALSE;
+	
+	GArray *renamed = g_array_new(FALSE, FALSE, sizeof(urename_t));
+	
+	for(guint32 id = utable.n_entries; id-- > 0;) {
+		const gchar *key = utable_key(id);
+		
+		if(!in_subtree(key, old_folder, old_len))
+			continue;
+		
+		urename_t entry = {
+			.key = g_strconcat(new_folder, key + old_len, NULL),
+			.count = utable.counts[id],
+			.checkpoint = (utable.epochs[id] == checkpoint_epoch
+				? utable.checkpoints[id] : utable.counts[id]),
+		};
+		
+		g_array_append_val(renamed, entry);
+		checkpoint_reached |= ucount_drop(id);
+	}
+	
+	for(guint i = 0; i < renamed->len; i++) {
+		urename_t *entry = &g_array_index(renamed, urename_t, i);
+		guint32 slot;
+		gsize len;
+		
+		guint32 hash = utable_hash(entry->key, &len);
+		
+		// Can't be sure that we haven't already seen the new one
+		if(utable_lookup(entry->key, hash, &slot) < 0) {
+			checkpoint_reached |= ucount_insert(entry->key, len, hash,
+				slot, entry->count, entry->checkpoint);
+		}
+		
+		g_free(entry->key);
+	}
+	
+	g_array_free(renamed, TRUE);
+	
+	if(checkpoint_reached && n_folders_over_checkpoint == 0)
+		global_checkpoint_reached_cb();
+}
+
+/* Cap the number of folders in the table, 0 for no cap. When it's full,
+ * the least recently updated folder is evicted to make room. */
+void ucount_set_max_folders(guint max_folders) {
+	utable.max_entries = max_folders;
+	
+	if(max_folders > 0 && utable.n_entries > max_folders) {
+		if(ucount_evict(utable.n_entries - max_folders))
+			global_checkpoint_reached_cb();
+	}
+}
+
+/* Approximate heap footprint of the table (index, entry arrays, key
+ * arena) and the prefix tree, for the benchmarks. The per-message UID
+ * sets aren't included. */
+gsize ucount_get_memory(void) {
+	if(!utable_initialized)
+		return 0;
+	
+	gsize per_entry = sizeof(*utable.key_offsets) + sizeof(*utable.counts)
+		+ sizeof(*utable.checkpoints) + sizeof(*utable.epochs)
+		+ sizeof(*utable.tree_nodes) + sizeof(*utable.excluded)
+		+ sizeof(*utable.uidsets) + sizeof(*utable.heap_pos)
+		+ sizeof(*utable.heap) + sizeof(*utable.lru_prev)
+		+ sizeof(*utable.lru_next);
+	
+	return (gsize) utable.n_slots * sizeof(uslot_t)
+		+ (gsize) utable.entries_cap * per_entry
+		+ utable.arena_cap + utree_get_memory();
+}
+
+guint64 ucount_get_generation(void) {
+	return table_generation;
+}
+
+/* Total unread mails over all folders, and how many of them are new
+ * (i.e. over the checkpoint). O(1), kept up to date on each event. */
+void ucount_get_totals(guint *unread, guint *new_mail) {
+	if(unread) *unread = total_unread;
+	if(new_mail) *new_mail = total_new;
+}
+
+/* Same, for the subtree under a URI prefix, e.g. an account ('folder://uid')
+ * or a folder branch. Returns FALSE if no known folder is under it. */
+gboolean ucount_get_subtree_totals(const gchar *prefix,
+	guint *unread, guint *new_mail)
+{
+	return utree_lookup(prefix, checkpoint_epoch, unread, new_mail);
+}
+
+/* The (up to) n folders with the most new mail, most first. The URIs are
+ * owned by the table, and only valid until the next change to it. Returns
+ * how many were filled in. O(n^2) for the n asked, regardless of the size
+ * of the table; n is meant to be small. */
+guint ucount_get_top_folders(guint n, const gchar **folders, guint *new_mail) {
+	// Heap positions that may come next: the children of those taken
+	guint32 *frontier = g_new(guint32, n + 1);
+	guint n_frontier = 0, n_top = 0;
+	
+	if(utable.heap_len > 0)
+		frontier[n_frontier++] = 0;
+	
+	while(n_top < n && n_frontier > 0) {
+		guint best = 0;
+		
+		for(guint i = 1; i < n_frontier; i++) {
+			if(heap_key(utable.heap[frontier[i]])
+					> heap_key(utable.heap[frontier[best]]))
+				best = i;
+		}
+		
+		guint32 pos = frontier[best];
+		guint32 id = utable.heap[pos];
+		
+		folders[n_top] = utable_key(id);
+		new_mail[n_top] = heap_key(id);
+		n_top++;
+		
+		frontier[best] = frontier[--n_frontier];
+		
+		for(guint32 child = 2 * pos + 1; child <= 2 * pos + 2
+				&& child < utable.heap_len && n_frontier <= n; child++)
+			frontier[n_frontier++] = child;
+	}
+	
+	g_free(frontier);
+	return n_top;
+}
+
+// Invoke cb for each account (top-level URI prefix) with its totals
+void ucount_foreach_account(void (*cb)(const gchar *account,
+	guint unread, guint new_mail, gpointer data), gpointer data)
+{
+	utree_foreach_child(UTREE_ROOT, checkpoint_epoch, cb, data);
 }
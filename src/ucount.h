@@ -1,11 +1,27 @@
 #ifndef EVOLUTION_TRAY_UCOUNT_H
 #define EVOLUTION_TRAY_UCOUNT_H
 
-gint ucount_init(void (*checkpoint_cb)(void));
+gint ucount_init(const gchar *snapshot_file, void (*checkpoint_cb)(void));
 void ucount_fini(void);
+void ucount_save(void);
 
 gint ucount_event(const gchar *folder, guint count);
 // void ucount_event_dud(const gchar *folder, guint count);
+gint ucount_uids_changed(const gchar *folder, GPtrArray *added, GPtrArray *gone);
 void ucount_set_checkpoint(void);
+void ucount_refilter(void);
+
+void ucount_remove(const gchar *folder);
+void ucount_rename(const gchar *old_folder, const gchar *new_folder);
+void ucount_set_max_folders(guint max_folders);
+
+gsize ucount_get_memory(void);
+guint64 ucount_get_generation(void);
+void ucount_get_totals(guint *unread, guint *new_mail);
+gboolean ucount_get_subtree_totals(const gchar *prefix,
+	guint *unread, guint *new_mail);
+guint ucount_get_top_folders(guint n, const gchar **folders, guint *new_mail);
+void ucount_foreach_account(void (*cb)(const gchar *account,
+	guint unread, guint new_mail, gpointer data), gpointer data);
 
 #endif
@@ -0,0 +1,193 @@
+/* Evoution Tray plugin
+ *  Copyright (C) 2025 George Katevenis <george_kate@hotmail.com>
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* The ufilter decides which folders count towards the unread status, from
+ * the folder-include and folder-exclude settings. A folder counts if it
+ * matches any of the include patterns (or if there are none), and none of
+ * the exclude ones.
+ *
+ * Patterns are globs ('*' and '?'). A pattern without a '/' is matched
+ * against the folder's name (the last component of its URI), so that e.g.
+ * 'Junk' excludes the Junk folder of every account. Otherwise, it's matched
+ * against the whole URI, minus the 'folder://' scheme, e.g. 'account-uid/
+ * INBOX/Lists*' for INBOX/Lists and everything under it. The URI is
+ * %-escaped; matching is against the unescaped form, so that patterns can
+ * be written as the names appear, e.g. 'Sent Items' or '[Gmail]'.
+ *
+ * The patterns are compiled when the settings change, with the common
+ * cases (no wildcards, or a single trailing '*') as plain string compares.
+ * Matching happens only once per folder; ucount caches the verdict. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <gio/gio.h>
+#include <glib/gprintf.h>
+
+#include "ufilter.h"
+
+typedef enum {
+	UFILTER_EXACT,
+	UFILTER_PREFIX,
+	UFILTER_GLOB,
+} ufilter_kind_t;
+
+typedef struct ufilter_rule_t {
+	ufilter_kind_t kind;
+	gboolean name_only;
+	
+	gchar *text; // without the trailing '*' for UFILTER_PREFIX
+	gsize len;
+	
+	GPatternSpec *spec;
+} ufilter_rule_t;
+
+static GArray *include_rules = NULL;
+static GArray *exclude_rules = NULL;
+
+// -----------------------------
+
+static void clear_rule(gpointer data) {
+	ufilter_rule_t *rule = data;
+	
+	g_free(rule->text);
+	g_clear_pointer(&rule->spec, g_pattern_spec_free);
+}
+
+static GArray *compile_rules(const gchar *const *patterns) {
+	GArray *rules = g_array_new(FALSE, FALSE, sizeof(ufilter_rule_t));
+	g_array_set_clear_func(rules, clear_rule);
+	
+	for(; patterns && *patterns; patterns++) {
+		const gchar *pattern = *patterns;
+		gsize len = strlen(pattern);
+		
+		if(len == 0)
+			continue;
+		
+		ufilter_rule_t rule = {
+			.name_only = (strchr(pattern, '/') == NULL),
+		};
+		
+		gsize wildcard = strcspn(pattern, "*?");
+		
+		if(wildcard == len) {
+			rule.kind = UFILTER_EXACT;
+			rule.text = g_strndup(pattern, len);
+			rule.len = len;
+		} else if(wildcard == len - 1 && pattern[wildcard] == '*') {
+			rule.kind = UFILTER_PREFIX;
+			rule.text = g_strndup(pattern, len - 1);
+			rule.len = len - 1;
+		} else {
+			rule.kind = UFILTER_GLOB;
+			rule.spec = g_pattern_spec_new(pattern);
+		}
+		
+		g_array_append_val(rules, rule);
+	}
+	
+	return rules;
+}
+
+static gboolean match_rule(const ufilter_rule_t *rule,
+	const gchar *path, gsize path_len, const gchar *name, gsize name_len)
+{
+	const gchar *subject = (rule->name_only ? name : path);
+	gsize len = (rule->name_only ? name_len : path_len);
+	
+	switch(rule->kind) {
+		case UFILTER_EXACT:
+			return (len == rule->len && memcmp(subject, rule->text, len) == 0);
+		case UFILTER_PREFIX:
+			return (len >= rule->len && memcmp(subject, rule->text, rule->len) == 0);
+		case UFILTER_GLOB:
+#if GLIB_CHECK_VERSION(2, 70, 0)
+			return g_pattern_spec_match(rule->spec, len, subject, NULL);
+#else
+			return g_pattern_match(rule->spec, len, subject, NULL);
+#endif
+	}
+	
+	return FALSE;
+}
+
+static gboolean match_any(GArray *rules, const gchar *path,
+	gsize path_len, const gchar *name, gsize name_len)
+{
+	for(guint i = 0; i < rules->len; i++) {
+		if(match_rule(&g_array_index(rules, ufilter_rule_t, i),
+				path, path_len, name, name_len))
+			return TRUE;
+	}
+	
+	return FALSE;
+}
+
+// -----------------------------
+
+/* Replace the current filters. Either may be NULL or empty. Previously
+ * returned verdicts may now be stale; see ucount_refilter(). */
+void ufilter_compile(const gchar *const *include, const gchar *const *exclude) {
+	ufilter_fini();
+	
+	include_rules = compile_rules(include);
+	exclude_rules = compile_rules(exclude);
+}
+
+void ufilter_fini(void) {
+	g_clear_pointer(&include_rules, g_array_unref);
+	g_clear_pointer(&exclude_rules, g_array_unref);
+}
+
+// Whether the folder should count towards the unread status
+gboolean ufilter_match(const gchar *uri) {
+	gboolean have_include = (include_rules && include_rules->len > 0);
+	gboolean have_exclude = (exclude_rules && exclude_rules->len > 0);
+	
+	if(!have_include && !have_exclude)
+		return TRUE;
+	
+	const gchar *path = strstr(uri, "://");
+	path = (path ? path + 3 : uri);
+	
+	// Left as is if it's not validly escaped
+	gchar *unescaped = g_uri_unescape_string(path, NULL);
+	
+	if(unescaped)
+		path = unescaped;
+	
+	const gchar *name = strrchr(path, '/');
+	name = (name ? name + 1 : path);
+	
+	gsize path_len = strlen(path);
+	gsize name_len = path_len - (name - path);
+	
+	gboolean match = TRUE;
+	
+	if(have_include && !match_any(include_rules, path, path_len, name, name_len))
+		match = FALSE;
+	else if(have_exclude && match_any(exclude_rules, path, path_len, name, name_len))
+		match = FALSE;
+	
+	g_free(unescaped);
+	return match;
+}
@@ -0,0 +1,9 @@
+#ifndef EVOLUTION_TRAY_UFILTER_H
+#define EVOLUTION_TRAY_UFILTER_H
+
+void ufilter_compile(const gchar *const *include, const gchar *const *exclude);
+void ufilter_fini(void);
+
+gboolean ufilter_match(const gchar *uri);
+
+#endif
@@ -0,0 +1,215 @@
+/* Evoution Tray plugin
+ *  Copyright (C) 2025 George Katevenis <george_kate@hotmail.com>
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* A set of message UIDs, e.g. the new mail of a folder. Folders can hold
+ * 100k+ messages, and new ones mostly get consecutive UIDs (IMAP assigns
+ * them in increasing order, and so do the local stores), so numeric UIDs
+ * are kept as a sorted array of runs (start, length). A set of 10k new
+ * mails in a handful of runs is then a few dozen bytes. Adding or removing
+ * a UID is a binary search over the runs, plus, at most, inserting or
+ * removing one run; it never depends on the size of the folder.
+ *
+ * UIDs that aren't plain numbers (e.g. Maildir's) can't form runs; they go
+ * in a plain string hash set instead, only created when first needed. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <gio/gio.h>
+#include <glib/gprintf.h>
+
+#include "uidset.h"
+
+typedef struct urun_t {
+	guint32 start;
+	guint32 len;
+} urun_t;
+
+struct uidset_t {
+	GArray *runs;
+	GHashTable *others;
+	guint size;
+};
+
+// -----------------------------
+
+/* Parse a UID as a plain decimal number. Leading zeros would not round-trip,
+ * and G_MAXUINT32 is left out so that start + len can't overflow. */
+static gboolean parse_uid(const gchar *uid, guint32 *value) {
+	guint64 v = 0;
+	const gchar *p;
+	
+	if(uid[0] == '\0' || (uid[0] == '0' && uid[1] != '\0'))
+		return FALSE;
+	
+	for(p = uid; *p; p++) {
+		if(*p < '0' || *p > '9' || p - uid >= 10)
+			return FALSE;
+		
+		v = v * 10 + (*p - '0');
+	}
+	
+	if(v >= G_MAXUINT32)
+		return FALSE;
+	
+	*value = v;
+	return TRUE;
+}
+
+// Index of the first run that starts after value (i.e. n_runs if none)
+static guint upper_bound(GArray *runs, guint32 value) {
+	guint lo = 0, hi = runs->len;
+	
+	while(lo < hi) {
+		guint mid = lo + (hi - lo) / 2;
+		
+		if(g_array_index(runs, urun_t, mid).start <= value)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	
+	return lo;
+}
+
+static gboolean runs_add(GArray *runs, guint32 value) {
+	guint i = upper_bound(runs, value);
+	
+	urun_t *prev = (i > 0 ? &g_array_index(runs, urun_t, i - 1) : NULL);
+	urun_t *next = (i < runs->len ? &g_array_index(runs, urun_t, i) : NULL);
+	
+	if(prev && value < prev->start + prev->len)
+		return FALSE;
+	
+	gboolean join_prev = (prev && prev->start + prev->len == value);
+	gboolean join_next = (next && next->start == value + 1);
+	
+	if(join_prev && join_next) {
+		prev->len += 1 + next->len;
+		g_array_remove_index(runs, i);
+	} else if(join_prev)
+		prev->len++;
+	else if(join_next) {
+		next->start--;
+		next->len++;
+	} else {
+		urun_t run = {.start = value, .len = 1};
+		g_array_insert_val(runs, i, run);
+	}
+	
+	return TRUE;
+}
+
+static gboolean runs_remove(GArray *runs, guint32 value) {
+	guint i = upper_bound(runs, value);
+	
+	if(i == 0)
+		return FALSE;
+	
+	urun_t *run = &g_array_index(runs, urun_t, i - 1);
+	guint32 end = run->start + run->len;
+	
+	if(value >= end)
+		return FALSE;
+	
+	if(run->len == 1)
+		g_array_remove_index(runs, i - 1);
+	else if(value == run->start) {
+		run->start++;
+		run->len--;
+	} else if(value == end - 1)
+		run->len--;
+	else {
+		// Split in two
+		urun_t tail = {.start = value + 1, .len = end - value - 1};
+		run->len = value - run->start;
+		
+		g_array_insert_val(runs, i, tail);
+	}
+	
+	return TRUE;
+}
+
+// -----------------------------
+
+uidset_t *uidset_new(void) {
+	uidset_t *set = g_new0(uidset_t, 1);
+	set->runs = g_array_new(FALSE, FALSE, sizeof(urun_t));
+	
+	return set;
+}
+
+void uidset_free(uidset_t *set) {
+	if(!set)
+		return;
+	
+	g_array_free(set->runs, TRUE);
+	g_clear_pointer(&set->others, g_hash_table_destroy);
+	g_free(set);
+}
+
+void uidset_clear(uidset_t *set) {
+	g_array_set_size(set->runs, 0);
+	g_clear_pointer(&set->others, g_hash_table_destroy);
+	set->size = 0;
+}
+
+// Returns whether the UID was not already in the set
+gboolean uidset_add(uidset_t *set, const gchar *uid) {
+	guint32 value;
+	gboolean added;
+	
+	if(parse_uid(uid, &value))
+		added = runs_add(set->runs, value);
+	else {
+		if(!set->others)
+			set->others = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+		
+		added = !g_hash_table_contains(set->others, uid);
+		if(added)
+			g_hash_table_add(set->others, g_strdup(uid));
+	}
+	
+	if(added)
+		set->size++;
+	
+	return added;
+}
+
+// Returns whether the UID was in the set
+gboolean uidset_remove(uidset_t *set, const gchar *uid) {
+	guint32 value;
+	gboolean removed;
+	
+	if(parse_uid(uid, &value))
+		removed = runs_remove(set->runs, value);
+	else
+		removed = (set->others && g_hash_table_remove(set->others, uid));
+	
+	if(removed)
+		set->size--;
+	
+	return removed;
+}
+
+guint uidset_size(const uidset_t *set) {
+	return set->size;
+}
@@ -0,0 +1,14 @@
+#ifndef EVOLUTION_TRAY_UIDSET_H
+#define EVOLUTION_TRAY_UIDSET_H
+
+typedef struct uidset_t uidset_t;
+
+uidset_t *uidset_new(void);
+void uidset_free(uidset_t *set);
+void uidset_clear(uidset_t *set);
+
+gboolean uidset_add(uidset_t *set, const gchar *uid);
+gboolean uidset_remove(uidset_t *set, const gchar *uid);
+guint uidset_size(const uidset_t *set);
+
+#endif
@@ -0,0 +1,147 @@
+/* Evoution Tray plugin
+ *  Copyright (C) 2025 George Katevenis <george_kate@hotmail.com>
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* The uqueue (the ucount ingest queue) sits between Evolution's folder
+ * unread events and the ucount table. After a reconnect or a resync,
+ * Evolution fires hundreds of these events back to back. Handling each
+ * one on the spot would also mean updating the tray icon (a D-Bus
+ * roundtrip for every host) for every intermediate state.
+ *
+ * So instead, we just append the events to a queue, and apply them in
+ * order from a low-priority idle source, in batches. Once the queue has
+ * been drained, the done-callback is invoked, which is where the caller
+ * should publish the resulting state. Since the events are applied in
+ * order and none are dropped, the final state is the same as if they
+ * had been applied one by one.
+ *
+ * The folder URIs are copied into a string chunk, which is cleared in one
+ * go whenever the queue becomes empty, so queueing costs no allocation
+ * per event (amortized). */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gio/gio.h>
+#include <glib/gprintf.h>
+
+#include "uqueue.h"
+
+// Max number of events applied per idle dispatch
+#define UQUEUE_BATCH 512
+
+typedef struct uevent_t {
+	const gchar *folder;
+	guint count;
+} uevent_t;
+
+static GArray *queue = NULL;
+static guint queue_head = 0;
+
+static GStringChunk *uri_chunk = NULL;
+static guint idle_id = 0;
+
+static void (*apply_event_cb)(const gchar *folder, guint count) = NULL;
+static void (*drained_cb)(void) = NULL;
+
+gint uqueue_init(void (*apply_cb)(const gchar *folder, guint count),
+	void (*done_cb)(void))
+{
+	queue = g_array_new(FALSE, FALSE, sizeof(uevent_t));
+	uri_chunk = g_string_chunk_new(4096);
+	
+	if(!queue || !uri_chunk) {
+		uqueue_fini();
+		return -1;
+	}
+	
+	apply_event_cb = apply_cb;
+	drained_cb = done_cb;
+	
+	return 0;
+}
+
+void uqueue_fini(void) {
+	g_clear_handle_id(&idle_id, g_source_remove);
+	
+	if(queue) {
+		g_array_free(queue, TRUE);
+		queue = NULL;
+	}
+	
+	g_clear_pointer(&uri_chunk, g_string_chunk_free);
+	
+	queue_head = 0;
+	apply_event_cb = NULL;
+	drained_cb = NULL;
+}
+
+/* Apply up to max events from the queue. Returns TRUE if the queue has
+ * been drained, in which case its storage is also recycled. */
+static gboolean apply_events(guint max) {
+	guint end = queue_head + MIN(queue->len - queue_head, max);
+	
+	/* Note: The callback doesn't push new events (it's called from the main
+	 * loop, same as the producer), so the array won't move under our feet. */
+	for(; queue_head < end; queue_head++) {
+		uevent_t *ev = &g_array_index(queue, uevent_t, queue_head);
+		apply_event_cb(ev->folder, ev->count);
+	}
+	
+	if(queue_head < queue->len)
+		return FALSE;
+	
+	g_array_set_size(queue, 0);
+	g_string_chunk_clear(uri_chunk);
+	queue_head = 0;
+	
+	return TRUE;
+}
+
+static gboolean on_idle_drain(gpointer data) {
+	if(!apply_events(UQUEUE_BATCH))
+		return G_SOURCE_CONTINUE;
+	
+	idle_id = 0;
+	drained_cb();
+	
+	return G_SOURCE_REMOVE;
+}
+
+void uqueue_push(const gchar *folder, guint count) {
+	uevent_t ev = {
+		.folder = g_string_chunk_insert(uri_chunk, folder),
+		.count = count
+	};
+	
+	g_array_append_val(queue, ev);
+	
+	if(idle_id == 0)
+		idle_id = g_idle_add_full(G_PRIORITY_LOW, on_idle_drain, NULL, NULL);
+}
+
+/* Synchronously apply all pending events. Used when we're about to act on
+ * the current state (e.g. acknowledge it), and it must be up to date. The
+ * done-callback is not invoked; publishing is then up to the caller. */
+void uqueue_flush(void) {
+	if(idle_id == 0)
+		return;
+	
+	g_clear_handle_id(&idle_id, g_source_remove);
+	apply_events(G_MAXUINT);
+}
@@ -0,0 +1,11 @@
+#ifndef EVOLUTION_TRAY_UQUEUE_H
+#define EVOLUTION_TRAY_UQUEUE_H
+
+gint uqueue_init(void (*apply_cb)(const gchar *folder, guint count),
+	void (*done_cb)(void));
+void uqueue_fini(void);
+
+void uqueue_push(const gchar *folder, guint count);
+void uqueue_flush(void);
+
+#endif
@@ -0,0 +1,312 @@
+/* Evoution Tray plugin
+ *  Copyright (C) 2025 George Katevenis <george_kate@hotmail.com>
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* The utree aggregates the ucount table per account and per folder branch.
+ * It's a prefix tree over the components of the folder URIs, e.g. for
+ * 'folder://account-uid/INBOX/Lists' there are nodes for 'folder://account-
+ * uid' (the account), 'folder://account-uid/INBOX', and the folder itself.
+ * Each node keeps the total unread and new mail counts of its subtree.
+ *
+ * Every ucount entry remembers its leaf node, so an event only walks up the
+ * parent links, adjusting each node by the folder's deltas: O(depth), no
+ * string handling. Nodes are also indexed by their prefix, so any subtree
+ * can be queried with a single lookup.
+ *
+ * The new mail counts follow ucount's lazy checkpoint scheme: a node's new
+ * count is only valid if its epoch is the current checkpoint epoch, and is
+ * 0 otherwise. This agrees with the folders below it, which all count as
+ * having no new mail until touched, right after the checkpoint is set.
+ *
+ * Nodes are reference counted by the folders under them, so that they go
+ * away along with the last one of these folders (e.g. when it's deleted).
+ * Freed nodes are kept on a free list for reuse, and the prefix strings are
+ * compacted once the dead ones outweigh the live ones. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <gio/gio.h>
+#include <glib/gprintf.h>
+
+#include "utree.h"
+
+#define UTREE_NONE G_MAXUINT32
+
+typedef struct utree_node_t {
+	const gchar *prefix;
+	
+	guint32 parent;
+	guint32 first_child;
+	guint32 next_sibling;
+	
+	guint unread;
+	guint new_mail;
+	guint32 epoch;
+	
+	// Number of folders at or under this node; 0 means it's free
+	guint32 refs;
+} utree_node_t;
+
+static GArray *nodes = NULL;
+
+// Free nodes, linked through next_sibling
+static guint32 free_nodes = UTREE_NONE;
+
+// prefix -> node id; the prefixes are stored in the string chunk
+static GHashTable *prefix_index = NULL;
+static GStringChunk *prefixes = NULL;
+
+// Bytes in the string chunk, and how many of them belong to freed nodes
+static gsize prefix_bytes = 0;
+static gsize dead_prefix_bytes = 0;
+
+gint utree_init(void) {
+	nodes = g_array_new(FALSE, FALSE, sizeof(utree_node_t));
+	prefix_index = g_hash_table_new(g_str_hash, g_str_equal);
+	prefixes = g_string_chunk_new(4096);
+	
+	utree_node_t root = {
+		.prefix = "",
+		.parent = UTREE_NONE,
+		.first_child = UTREE_NONE,
+		.next_sibling = UTREE_NONE,
+	};
+	
+	g_array_append_val(nodes, root);
+	
+	return 0;
+}
+
+void utree_fini(void) {
+	if(nodes) {
+		g_array_free(nodes, TRUE);
+		nodes = NULL;
+	}
+	
+	g_clear_pointer(&prefix_index, g_hash_table_destroy);
+	g_clear_pointer(&prefixes, g_string_chunk_free);
+	
+	free_nodes = UTREE_NONE;
+	prefix_bytes = 0;
+	dead_prefix_bytes = 0;
+}
+
+/* Approximate heap footprint: the nodes, their prefixes, and the index
+ * (a hash, a key and a value per entry). For the benchmarks. */
+gsize utree_get_memory(void) {
+	if(!nodes)
+		return 0;
+	
+	return nodes->len * sizeof(utree_node_t) + prefix_bytes
+		+ g_hash_table_size(prefix_index) * (sizeof(guint) + 2 * sizeof(gpointer));
+}
+
+static inline utree_node_t *node_at(guint32 id) {
+	return &g_array_index(nodes, utree_node_t, id);
+}
+
+static guint32 get_or_add(guint32 parent, const gchar *prefix, gsize len) {
+	gchar *key = g_alloca(len + 1);
+	memcpy(key, prefix, len);
+	key[len] = '\0';
+	
+	gpointer value;
+	if(g_hash_table_lookup_extended(prefix_index, key, NULL, &value))
+		return GPOINTER_TO_UINT(value);
+	
+	utree_node_t node = {
+		.prefix = g_string_chunk_insert_len(prefixes, prefix, len),
+		.parent = parent,
+		.first_child = UTREE_NONE,
+		.next_sibling = node_at(parent)->first_child,
+	};
+	
+	prefix_bytes += len + 1;
+	
+	guint32 id;
+	
+	if(free_nodes != UTREE_NONE) {
+		id = free_nodes;
+		free_nodes = node_at(id)->next_sibling;
+		*node_at(id) = node;
+	} else {
+		id = nodes->len;
+		g_array_append_val(nodes, node);
+	}
+	
+	node_at(parent)->first_child = id;
+	
+	g_hash_table_insert(prefix_index, (gpointer) node_at(id)->prefix,
+		GUINT_TO_POINTER(id));
+	
+	return id;
+}
+
+/* Returns the leaf node for the folder, creating it and any missing
+ * ancestors. Called once per folder, when it enters the ucount table,
+ * and balanced by a utree_remove() when it leaves. */
+guint32 utree_insert(const gchar *uri) {
+	guint32 node = UTREE_ROOT;
+	
+	// The scheme is not a component of its own
+	const gchar *p = strstr(uri, "://");
+	p = (p ? p + 3 : uri);
+	
+	for(;; p++) {
+		if(*p == '/' || *p == '\0') {
+			if(p > uri) {
+				node = get_or_add(node, uri, p - uri);
+				node_at(node)->refs++;
+			}
+			
+			if(*p == '\0')
+				break;
+		}
+	}
+	
+	return node;
+}
+
+// Re-build the string chunk with only the live prefixes
+static void compact_prefixes(void) {
+	GStringChunk *chunk = g_string_chunk_new(4096);
+	
+	g_hash_table_remove_all(prefix_index);
+	
+	for(guint32 i = UTREE_ROOT + 1; i < nodes->len; i++) {
+		utree_node_t *n = node_at(i);
+		if(n->refs == 0) continue;
+		
+		n->prefix = g_string_chunk_insert(chunk, n->prefix);
+		g_hash_table_insert(prefix_index, (gpointer) n->prefix,
+			GUINT_TO_POINTER(i));
+	}
+	
+	g_string_chunk_free(prefixes);
+	prefixes = chunk;
+	
+	prefix_bytes -= dead_prefix_bytes;
+	dead_prefix_bytes = 0;
+}
+
+static void free_node(guint32 id) {
+	utree_node_t *n = node_at(id);
+	utree_node_t *parent = node_at(n->parent);
+	
+	// Unlink from the parent; the child lists are singly linked
+	if(parent->first_child == id)
+		parent->first_child = n->next_sibling;
+	else {
+		guint32 c = parent->first_child;
+		while(node_at(c)->next_sibling != id)
+			c = node_at(c)->next_sibling;
+		
+		node_at(c)->next_sibling = n->next_sibling;
+	}
+	
+	g_hash_table_remove(prefix_index, n->prefix);
+	dead_prefix_bytes += strlen(n->prefix) + 1;
+	
+	*n = (utree_node_t) {
+		.parent = UTREE_NONE,
+		.first_child = UTREE_NONE,
+		.next_sibling = free_nodes,
+	};
+	
+	free_nodes = id;
+}
+
+/* A folder is leaving the ucount table. Its counts must have already been
+ * taken out (with utree_update()). Its node, and any ancestors that only
+ * existed for it, are freed. */
+void utree_remove(guint32 node) {
+	while(node != UTREE_ROOT) {
+		guint32 parent = node_at(node)->parent;
+		
+		if(--node_at(node)->refs == 0)
+			free_node(node);
+		
+		node = parent;
+	}
+	
+	if(dead_prefix_bytes > prefix_bytes / 2)
+		compact_prefixes();
+}
+
+/* Adjust the folder's node and all of its ancestors by the deltas. These
+ * are unsigned, but (mod 2^n) arithmetic works out just fine. */
+void utree_update(guint32 node, guint d_unread, guint d_new, guint32 epoch) {
+	for(; node != UTREE_NONE; node = node_at(node)->parent) {
+		utree_node_t *n = node_at(node);
+		
+		if(n->epoch != epoch) {
+			n->new_mail = 0;
+			n->epoch = epoch;
+		}
+		
+		n->unread += d_unread;
+		n->new_mail += d_new;
+	}
+}
+
+/* Zero the new mail count of every node; only for when the checkpoint
+ * epoch wraps around, and stale epochs could alias. */
+void utree_reset_new(guint32 epoch) {
+	for(guint32 i = 0; i < nodes->len; i++) {
+		node_at(i)->new_mail = 0;
+		node_at(i)->epoch = epoch;
+	}
+}
+
+static void node_counts(utree_node_t *n, guint32 epoch,
+	guint *unread, guint *new_mail)
+{
+	if(unread) *unread = n->unread;
+	if(new_mail) *new_mail = (n->epoch == epoch ? n->new_mail : 0);
+}
+
+/* Totals of the subtree under prefix (which must be at a component
+ * boundary, e.g. an account's 'folder://uid'). */
+gboolean utree_lookup(const gchar *prefix, guint32 epoch,
+	guint *unread, guint *new_mail)
+{
+	gpointer value;
+	
+	if(!g_hash_table_lookup_extended(prefix_index, prefix, NULL, &value))
+		return FALSE;
+	
+	node_counts(node_at(GPOINTER_TO_UINT(value)), epoch, unread, new_mail);
+	return TRUE;
+}
+
+void utree_foreach_child(guint32 node, guint32 epoch,
+	void (*cb)(const gchar *prefix, guint unread, guint new_mail, gpointer data),
+	gpointer data)
+{
+	for(guint32 c = node_at(node)->first_child; c != UTREE_NONE;
+		c = node_at(c)->next_sibling)
+	{
+		guint unread, new_mail;
+		node_counts(node_at(c), epoch, &unread, &new_mail);
+		
+		cb(node_at(c)->prefix, unread, new_mail, data);
+	}
+}
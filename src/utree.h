@@ -0,0 +1,21 @@
+#ifndef EVOLUTION_TRAY_UTREE_H
+#define EVOLUTION_TRAY_UTREE_H
+
+#define UTREE_ROOT 0
+
+gint utree_init(void);
+void utree_fini(void);
+gsize utree_get_memory(void);
+
+guint32 utree_insert(const gchar *uri);
+void utree_remove(guint32 node);
+void utree_update(guint32 node, guint d_unread, guint d_new, guint32 epoch);
+void utree_reset_new(guint32 epoch);
+
+gboolean utree_lookup(const gchar *prefix, guint32 epoch,
+	guint *unread, guint *new_mail);
+void utree_foreach_child(guint32 node, guint32 epoch,
+	void (*cb)(const gchar *prefix, guint unread, guint new_mail, gpointer data),
+	gpointer data);
+
+#endif
@@ -0,0 +1,623 @@
+/* Evoution Tray plugin
+ *  Copyright (C) 2025 George Katevenis <george_kate@hotmail.com>
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Randomized test of ucount against a reference GHashTable of folders:
+ * events, checkpoints, removals, renames, and LRU evictions. The table's
+ * removal (backward-shift deletion, then moving the last entry into the
+ * freed id) has to keep the index, the LRU list, the tree and the heap in
+ * sync; after every step, the totals, the lookups, the account subtrees
+ * and the top folders are all checked. The snapshot is tested too: a
+ * round trip, mid-run, and the rejection of damaged files. The source is
+ * included directly, for access to the table. */
+
+#include <glib/gstdio.h>
+
+#include "../src/ucount.c"
+
+#define N_ACCOUNTS 4
+#define N_TOP 8
+
+typedef struct ref_folder_t {
+	guint count;
+	guint checkpoint;
+	guint64 stamp; // of the last event, for the LRU
+} ref_folder_t;
+
+static GHashTable *ref = NULL;
+static GRand *test_rand = NULL;
+static guint64 n_stamps = 0;
+static guint max_folders = 0;
+
+static guint n_callbacks = 0;
+static guint n_expected_callbacks = 0;
+
+static gchar *snapshot_dir = NULL;
+static gchar *snapshot_file = NULL;
+
+static void on_checkpoint(void) {
+	n_callbacks++;
+}
+
+static ref_folder_t *ref_folder_dup(const ref_folder_t *f) {
+	ref_folder_t *copy = g_new(ref_folder_t, 1);
+	*copy = *f;
+	
+	return copy;
+}
+
+static gboolean in_ref_subtree(const gchar *key, const gchar *prefix) {
+	return in_subtree(key, prefix, strlen(prefix));
+}
+
+static guint ref_n_over_checkpoint(void) {
+	GHashTableIter iter;
+	ref_folder_t *f;
+	guint n = 0;
+	
+	g_hash_table_iter_init(&iter, ref);
+	while(g_hash_table_iter_next(&iter, NULL, (gpointer *) &f))
+		n += (f->count > f->checkpoint);
+	
+	return n;
+}
+
+// The folders were over the checkpoint before an operation, and now aren't
+static void expect_callback(guint n_over_before) {
+	if(n_over_before > 0 && ref_n_over_checkpoint() == 0)
+		n_expected_callbacks++;
+}
+
+static void ref_remove_where(gboolean (*pred)(const gchar *, const gchar *),
+	const gchar *prefix, GHashTable *removed)
+{
+	GHashTableIter iter;
+	gchar *key;
+	ref_folder_t *f;
+	
+	g_hash_table_iter_init(&iter, ref);
+	while(g_hash_table_iter_next(&iter, (gpointer *) &key, (gpointer *) &f)) {
+		if(pred(key, prefix)) {
+			if(removed)
+				g_hash_table_insert(removed, g_strdup(key), ref_folder_dup(f));
+			
+			g_hash_table_iter_remove(&iter);
+		}
+	}
+}
+
+static void ref_evict(guint n_keep) {
+	while(max_folders > 0 && g_hash_table_size(ref) > n_keep) {
+		GHashTableIter iter;
+		gchar *key, *oldest = NULL;
+		ref_folder_t *f;
+		guint64 oldest_stamp = G_MAXUINT64;
+		
+		g_hash_table_iter_init(&iter, ref);
+		while(g_hash_table_iter_next(&iter, (gpointer *) &key, (gpointer *) &f)) {
+			if(f->stamp < oldest_stamp) {
+				oldest_stamp = f->stamp;
+				oldest = key;
+			}
+		}
+		
+		g_hash_table_remove(ref, oldest);
+	}
+}
+
+// -----------------------------
+
+static gint cmp_new_desc(gconstpointer a, gconstpointer b) {
+	guint x = *(const guint *) a, y = *(const guint *) b;
+	return (x < y) - (x > y);
+}
+
+static void check_state(void) {
+	GHashTableIter iter;
+	gchar *key;
+	ref_folder_t *f;
+	
+	guint unread = 0, new_mail = 0;
+	GArray *news = g_array_new(FALSE, FALSE, sizeof(guint));
+	
+	g_assert_cmpuint(utable.n_entries, ==, g_hash_table_size(ref));
+	
+	g_hash_table_iter_init(&iter, ref);
+	while(g_hash_table_iter_next(&iter, (gpointer *) &key, (gpointer *) &f)) {
+		gsize len;
+		gint64 id = utable_lookup(key, utable_hash(key, &len), NULL);
+		
+		g_assert_cmpint(id, >=, 0);
+		g_assert_cmpstr(utable_key(id), ==, key);
+		g_assert_cmpuint(utable.counts[id], ==, f->count);
+		g_assert_cmpuint((utable.epochs[id] == checkpoint_epoch
+			? utable.checkpoints[id] : utable.counts[id]), ==, f->checkpoint);
+		
+		unread += f->count;
+		new_mail += f->count - f->checkpoint;
+		
+		if(f->count > f->checkpoint) {
+			guint n = f->count - f->checkpoint;
+			g_array_append_val(news, n);
+		}
+	}
+	
+	guint total_unread, total_new_mail;
+	ucount_get_totals(&total_unread, &total_new_mail);
+	
+	g_assert_cmpuint(total_unread, ==, unread);
+	g_assert_cmpuint(total_new_mail, ==, new_mail);
+	g_assert_cmpint(n_folders_over_checkpoint, ==, news->len);
+	g_assert_cmpuint(n_callbacks, ==, n_expected_callbacks);
+	
+	// The LRU list holds every entry once
+	guint n_lru = 0;
+	for(guint32 id = utable.lru_head; id != UTABLE_NONE; id = utable.lru_next[id])
+		n_lru++;
+	
+	g_assert_cmpuint(n_lru, ==, utable.n_entries);
+	
+	// Accounts' subtrees
+	for(gint a = 0; a < N_ACCOUNTS; a++) {
+		gchar *account = g_strdup_printf("folder://account-%d", a);
+		guint ref_unread = 0, ref_new = 0, sub_unread, sub_new;
+		gboolean any = FALSE;
+		
+		g_hash_table_iter_init(&iter, ref);
+		while(g_hash_table_iter_next(&iter, (gpointer *) &key, (gpointer *) &f)) {
+			if(in_ref_subtree(key, account)) {
+				ref_unread += f->count;
+				ref_new += f->count - f->checkpoint;
+				any = TRUE;
+			}
+		}
+		
+		g_assert_cmpint(ucount_get_subtree_totals(account,
+			&sub_unread, &sub_new), ==, any);
+		
+		if(any) {
+			g_assert_cmpuint(sub_unread, ==, ref_unread);
+			g_assert_cmpuint(sub_new, ==, ref_new);
+		}
+		
+		g_free(account);
+	}
+	
+	// Top folders: the largest new mail counts, in order, and the right ones
+	const gchar *top[N_TOP];
+	guint top_new[N_TOP];
+	
+	g_array_sort(news, cmp_new_desc);
+	
+	guint n_top = ucount_get_top_folders(N_TOP, top, top_new);
+	g_assert_cmpuint(n_top, ==, MIN(N_TOP, news->len));
+	
+	for(guint i = 0; i < n_top; i++) {
+		g_assert_cmpuint(top_new[i], ==, g_array_index(news, guint, i));
+		
+		f = g_hash_table_lookup(ref, top[i]);
+		g_assert_nonnull(f);
+		g_assert_cmpuint(f->count - f->checkpoint, ==, top_new[i]);
+	}
+	
+	g_array_free(news, TRUE);
+}
+
+// -----------------------------
+
+static gchar *random_folder(void) {
+	gint a = g_rand_int_range(test_rand, 0, N_ACCOUNTS);
+	gint x = g_rand_int_range(test_rand, 0, 40);
+	
+	if(g_rand_boolean(test_rand))
+		return g_strdup_printf("folder://account-%d/F%d", a, x);
+	
+	return g_strdup_printf("folder://account-%d/F%d/S%d", a, x,
+		g_rand_int_range(test_rand, 0, 5));
+}
+
+static void do_event(void) {
+	gchar *folder = random_folder();
+	guint count = g_rand_int_range(test_rand, 0, 12);
+	guint n_over = ref_n_over_checkpoint();
+	
+	gint delta = ucount_event(folder, count);
+	ref_folder_t *f = g_hash_table_lookup(ref, folder);
+	
+	if(!f) {
+		ref_evict(max_folders - 1);
+		
+		f = g_new(ref_folder_t, 1);
+		f->count = f->checkpoint = count;
+		g_hash_table_insert(ref, g_strdup(folder), f);
+		
+		g_assert_cmpint(delta, ==, 0);
+	} else {
+		g_assert_cmpint(delta, ==, (gint) count - (gint) f->count);
+		
+		f->count = count;
+		f->checkpoint = MIN(f->checkpoint, count);
+	}
+	
+	f->stamp = ++n_stamps;
+	expect_callback(n_over);
+	
+	g_free(folder);
+}
+
+static void do_checkpoint(void) {
+	GHashTableIter iter;
+	ref_folder_t *f;
+	
+	ucount_set_checkpoint();
+	
+	g_hash_table_iter_init(&iter, ref);
+	while(g_hash_table_iter_next(&iter, NULL, (gpointer *) &f))
+		f->checkpoint = f->count;
+}
+
+static void do_remove(void) {
+	guint n_over = ref_n_over_checkpoint();
+	gchar *folder;
+	
+	// Sometimes a whole account
+	if(g_rand_int_range(test_rand, 0, 4) == 0) {
+		folder = g_strdup_printf("folder://account-%d",
+			g_rand_int_range(test_rand, 0, N_ACCOUNTS));
+	} else
+		folder = random_folder();
+	
+	ucount_remove(folder);
+	ref_remove_where(in_ref_subtree, folder, NULL);
+	
+	expect_callback(n_over);
+	g_free(folder);
+}
+
+static void do_set_max_folders(void) {
+	guint n_over = ref_n_over_checkpoint();
+	
+	max_folders = g_rand_int_range(test_rand, 50, 250);
+	
+	ucount_set_max_folders(max_folders);
+	ref_evict(max_folders);
+	
+	expect_callback(n_over);
+}
+
+// Renames within an account; unlimited table only (see test_rename)
+static void do_rename(void) {
+	gint a = g_rand_int_range(test_rand, 0, N_ACCOUNTS);
+	gchar *old_folder = g_strdup_printf("folder://account-%d/F%d",
+		a, g_rand_int_range(test_rand, 0, 40));
+	gchar *new_folder = g_strdup_printf("folder://account-%d/F%d",
+		a, g_rand_int_range(test_rand, 0, 40));
+	
+	if(strcmp(old_folder, new_folder) != 0) {
+		GHashTable *renamed = g_hash_table_new_full(
+			g_str_hash, g_str_equal, g_free, g_free);
+		GHashTableIter iter;
+		gchar *key;
+		ref_folder_t *f;
+		
+		guint n_over = ref_n_over_checkpoint();
+		
+		ucount_rename(old_folder, new_folder);
+		ref_remove_where(in_ref_subtree, old_folder, renamed);
+		
+		// A folder that already exists under the new name is kept as is
+		g_hash_table_iter_init(&iter, renamed);
+		while(g_hash_table_iter_next(&iter, (gpointer *) &key, (gpointer *) &f)) {
+			gchar *new_key = g_strconcat(new_folder,
+				key + strlen(old_folder), NULL);
+			
+			if(!g_hash_table_contains(ref, new_key)) {
+				g_hash_table_insert(ref, new_key, ref_folder_dup(f));
+				new_key = NULL;
+			}
+			
+			g_free(new_key);
+		}
+		
+		g_hash_table_destroy(renamed);
+		expect_callback(n_over);
+	}
+	
+	g_free(old_folder);
+	g_free(new_folder);
+}
+
+// -----------------------------
+
+static void setup(const gchar *snapshot) {
+	ref = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	test_rand = g_rand_new_with_seed(1);
+	n_stamps = 0;
+	max_folders = 0;
+	n_callbacks = n_expected_callbacks = 0;
+	
+	ucount_init(snapshot, on_checkpoint);
+}
+
+static void teardown(void) {
+	ucount_fini();
+	
+	g_clear_pointer(&test_rand, g_rand_free);
+	g_clear_pointer(&ref, g_hash_table_destroy);
+}
+
+// Events, removals and evictions, on a capped table
+static void test_evict(void) {
+	setup(NULL);
+	
+	max_folders = 150;
+	ucount_set_max_folders(max_folders);
+	
+	for(gint i = 0; i < 20000; i++) {
+		gint r = g_rand_int_range(test_rand, 0, 1000);
+		
+		if(r < 5)
+			do_checkpoint();
+		else if(r < 15)
+			do_remove();
+		else if(r < 17)
+			do_set_max_folders();
+		else
+			do_event();
+		
+		check_state();
+	}
+	
+	teardown();
+}
+
+/* Events, removals and renames. The renamed folders are inserted in an
+ * order that the reference can't tell, so no cap (and thus no LRU). */
+static void test_rename(void) {
+	setup(NULL);
+	
+	for(gint i = 0; i < 20000; i++) {
+		gint r = g_rand_int_range(test_rand, 0, 1000);
+		
+		if(r < 5)
+			do_checkpoint();
+		else if(r < 10)
+			do_remove();
+		else if(r < 20)
+			do_rename();
+		else
+			do_event();
+		
+		check_state();
+	}
+	
+	teardown();
+}
+
+// -----------------------------
+
+static void setup_snapshot(void) {
+	snapshot_dir = g_dir_make_tmp("ucount-test-XXXXXX", NULL);
+	g_assert_nonnull(snapshot_dir);
+	
+	snapshot_file = g_build_filename(snapshot_dir, "ucount.bin", NULL);
+}
+
+static void teardown_snapshot(void) {
+	g_remove(snapshot_file);
+	g_rmdir(snapshot_dir);
+	
+	g_clear_pointer(&snapshot_file, g_free);
+	g_clear_pointer(&snapshot_dir, g_free);
+}
+
+// The keys, most recently updated first
+static GPtrArray *lru_keys(void) {
+	GPtrArray *keys = g_ptr_array_new_with_free_func(g_free);
+	
+	for(guint32 id = utable.lru_head; id != UTABLE_NONE; id = utable.lru_next[id])
+		g_ptr_array_add(keys, g_strdup(utable_key(id)));
+	
+	return keys;
+}
+
+/* Save and re-load the table every so often. The counts, the checkpoints
+ * (some of them still lazy when saved) and the LRU order must survive it;
+ * the evictions after the load have to agree with the reference. */
+static void test_snapshot(void) {
+	setup_snapshot();
+	setup(snapshot_file);
+	
+	max_folders = 150;
+	ucount_set_max_folders(max_folders);
+	
+	for(gint round = 0; round < 20; round++) {
+		for(gint i = 0; i < 500; i++) {
+			gint r = g_rand_int_range(test_rand, 0, 1000);
+			
+			if(r < 5)
+				do_checkpoint();
+			else if(r < 15)
+				do_remove();
+			else
+				do_event();
+		}
+		
+		// The folders without events since are left at the lazy checkpoint
+		do_checkpoint();
+		
+		for(gint i = 0; i < 20; i++)
+			do_event();
+		
+		check_state();
+		
+		GPtrArray *before = lru_keys();
+		
+		ucount_fini();
+		g_assert_true(g_file_test(snapshot_file, G_FILE_TEST_IS_REGULAR));
+		
+		ucount_init(snapshot_file, on_checkpoint);
+		ucount_set_max_folders(max_folders);
+		
+		GPtrArray *after = lru_keys();
+		g_assert_cmpuint(after->len, ==, before->len);
+		
+		for(guint i = 0; i < before->len; i++)
+			g_assert_cmpstr(after->pdata[i], ==, before->pdata[i]);
+		
+		g_ptr_array_unref(before);
+		g_ptr_array_unref(after);
+		
+		check_state();
+	}
+	
+	teardown();
+	teardown_snapshot();
+}
+
+#define N_SNAPSHOT_FOLDERS 10
+
+// Save a small table, and read back the snapshot
+static gchar *save_snapshot(gsize *len) {
+	gchar *contents;
+	
+	ucount_init(snapshot_file, on_checkpoint);
+	
+	for(guint i = 0; i < N_SNAPSHOT_FOLDERS; i++) {
+		gchar *folder = g_strdup_printf("folder://account-0/F%u", i);
+		ucount_event(folder, i + 1);
+		g_free(folder);
+	}
+	
+	ucount_fini();
+	
+	g_assert_true(g_file_get_contents(snapshot_file, &contents, len, NULL));
+	return contents;
+}
+
+static gchar *copy_snapshot(const gchar *contents, gsize len) {
+	gchar *copy = g_malloc(len);
+	memcpy(copy, contents, len);
+	
+	return copy;
+}
+
+// Load the snapshot; a damaged one must be refused, leaving the table empty
+static void load_snapshot(const gchar *contents, gsize len, gboolean valid) {
+	g_assert_true(g_file_set_contents(snapshot_file, contents, len, NULL));
+	
+	if(!valid) {
+		g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
+			"Ignoring invalid unread count snapshot*");
+	}
+	
+	ucount_init(snapshot_file, on_checkpoint);
+	g_test_assert_expected_messages();
+	
+	g_assert_cmpuint(utable.n_entries, ==, (valid ? N_SNAPSHOT_FOLDERS : 0));
+	ucount_fini();
+}
+
+static void test_snapshot_header(void) {
+	setup_snapshot();
+	
+	gsize len;
+	gchar *contents = save_snapshot(&len);
+	gchar *copy;
+	
+	load_snapshot(contents, len, TRUE);
+	
+	copy = copy_snapshot(contents, len);
+	copy[0] ^= 0xff;
+	load_snapshot(copy, len, FALSE);
+	g_free(copy);
+	
+	copy = copy_snapshot(contents, len);
+	((usnap_header_t *) copy)->version++;
+	load_snapshot(copy, len, FALSE);
+	g_free(copy);
+	
+	copy = copy_snapshot(contents, len);
+	((usnap_header_t *) copy)->n_entries++;
+	load_snapshot(copy, len, FALSE);
+	g_free(copy);
+	
+	copy = copy_snapshot(contents, len);
+	((usnap_header_t *) copy)->n_entries = G_MAXUINT32;
+	load_snapshot(copy, len, FALSE);
+	g_free(copy);
+	
+	// Truncated, or with trailing garbage
+	load_snapshot(contents, len - 1, FALSE);
+	
+	copy = g_malloc0(len + 4);
+	memcpy(copy, contents, len);
+	load_snapshot(copy, len + 4, FALSE);
+	g_free(copy);
+	
+	g_free(contents);
+	teardown_snapshot();
+}
+
+static void test_snapshot_entries(void) {
+	setup_snapshot();
+	
+	gsize len;
+	gchar *contents = save_snapshot(&len);
+	gchar *copy;
+	
+	const usnap_header_t *header = (const usnap_header_t *) contents;
+	gsize n = header->n_entries;
+	
+	guint32 *key_offsets, *counts, *checkpoints;
+	
+	// A key outside the arena
+	copy = copy_snapshot(contents, len);
+	key_offsets = (guint32 *) (copy + sizeof(usnap_header_t)) + n;
+	key_offsets[n - 1] = header->arena_len;
+	load_snapshot(copy, len, FALSE);
+	g_free(copy);
+	
+	// A checkpoint over the count
+	copy = copy_snapshot(contents, len);
+	counts = (guint32 *) (copy + sizeof(usnap_header_t)) + 2 * n;
+	checkpoints = counts + n;
+	checkpoints[0] = counts[0] + 1;
+	load_snapshot(copy, len, FALSE);
+	g_free(copy);
+	
+	// An arena that doesn't end with a NUL
+	copy = copy_snapshot(contents, len);
+	copy[len - 1] = 'x';
+	load_snapshot(copy, len, FALSE);
+	g_free(copy);
+	
+	g_free(contents);
+	teardown_snapshot();
+}
+
+int main(int argc, char *argv[]) {
+	g_test_init(&argc, &argv, NULL);
+	
+	g_test_add_func("/ucount/evict", test_evict);
+	g_test_add_func("/ucount/rename", test_rename);
+	g_test_add_func("/ucount/snapshot", test_snapshot);
+	g_test_add_func("/ucount/snapshot/header", test_snapshot_header);
+	g_test_add_func("/ucount/snapshot/entries", test_snapshot_entries);
+	
+	return g_test_run();
+}
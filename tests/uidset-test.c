@@ -0,0 +1,178 @@
+/* Evoution Tray plugin
+ *  Copyright (C) 2025 George Katevenis <george_kate@hotmail.com>
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Tests for uidset, against a plain string hash set as the reference. The
+ * source is included directly, so that the runs themselves can be checked
+ * (sorted, disjoint, and never adjacent, i.e. always merged). */
+
+#include "../src/uidset.c"
+
+// Check the runs, and that they hold exactly the numeric UIDs of ref
+static void check_set(uidset_t *set, GHashTable *ref) {
+	guint n_numeric = 0;
+	
+	for(guint i = 0; i < set->runs->len; i++) {
+		urun_t *run = &g_array_index(set->runs, urun_t, i);
+		
+		g_assert_cmpuint(run->len, >, 0);
+		
+		if(i > 0) {
+			urun_t *prev = run - 1;
+			g_assert_cmpuint(prev->start + prev->len, <, run->start);
+		}
+		
+		for(guint32 v = run->start; v < run->start + run->len; v++) {
+			gchar *uid = g_strdup_printf("%u", v);
+			g_assert_true(g_hash_table_contains(ref, uid));
+			g_free(uid);
+		}
+		
+		n_numeric += run->len;
+	}
+	
+	guint n_others = (set->others ? g_hash_table_size(set->others) : 0);
+	
+	g_assert_cmpuint(n_numeric + n_others, ==, g_hash_table_size(ref));
+	g_assert_cmpuint(uidset_size(set), ==, g_hash_table_size(ref));
+}
+
+static void test_parse(void) {
+	guint32 v;
+	
+	g_assert_true(parse_uid("0", &v) && v == 0);
+	g_assert_true(parse_uid("42", &v) && v == 42);
+	g_assert_true(parse_uid("1000000000", &v) && v == 1000000000);
+	g_assert_true(parse_uid("4294967294", &v) && v == G_MAXUINT32 - 1);
+	
+	// G_MAXUINT32 itself, and anything that doesn't round-trip
+	g_assert_false(parse_uid("4294967295", &v));
+	g_assert_false(parse_uid("9999999999", &v));
+	g_assert_false(parse_uid("10000000000", &v));
+	g_assert_false(parse_uid("007", &v));
+	g_assert_false(parse_uid("00", &v));
+	g_assert_false(parse_uid("", &v));
+	g_assert_false(parse_uid("-1", &v));
+	g_assert_false(parse_uid("12a", &v));
+	g_assert_false(parse_uid("1486.maildir:2,S", &v));
+}
+
+static void test_runs(void) {
+	uidset_t *set = uidset_new();
+	
+	// Join next, join prev, then both
+	g_assert_true(uidset_add(set, "10"));
+	g_assert_true(uidset_add(set, "9"));
+	g_assert_true(uidset_add(set, "12"));
+	g_assert_true(uidset_add(set, "13"));
+	g_assert_cmpuint(set->runs->len, ==, 2);
+	
+	g_assert_true(uidset_add(set, "11"));
+	g_assert_cmpuint(set->runs->len, ==, 1);
+	g_assert_false(uidset_add(set, "11"));
+	g_assert_cmpuint(uidset_size(set), ==, 5);
+	
+	// Split, then trim both ends, then drop a single-UID run
+	g_assert_true(uidset_remove(set, "11"));
+	g_assert_cmpuint(set->runs->len, ==, 2);
+	g_assert_true(uidset_remove(set, "9"));
+	g_assert_true(uidset_remove(set, "13"));
+	g_assert_true(uidset_remove(set, "10"));
+	g_assert_cmpuint(set->runs->len, ==, 1);
+	g_assert_false(uidset_remove(set, "10"));
+	g_assert_false(uidset_remove(set, "14"));
+	g_assert_cmpuint(uidset_size(set), ==, 1);
+	
+	// The top of the range, and the string fallback
+	g_assert_true(uidset_add(set, "4294967294"));
+	g_assert_true(uidset_add(set, "4294967295"));
+	g_assert_true(uidset_add(set, "012"));
+	g_assert_false(uidset_add(set, "012"));
+	g_assert_cmpuint(uidset_size(set), ==, 4);
+	g_assert_true(uidset_remove(set, "012"));
+	g_assert_true(uidset_remove(set, "12"));
+	g_assert_cmpuint(uidset_size(set), ==, 2);
+	
+	uidset_clear(set);
+	g_assert_cmpuint(uidset_size(set), ==, 0);
+	g_assert_cmpuint(set->runs->len, ==, 0);
+	
+	uidset_free(set);
+}
+
+static gchar *random_uid(GRand *rand) {
+	guint32 v = g_rand_int_range(rand, 0, 500);
+	
+	switch(g_rand_int_range(rand, 0, 20)) {
+		case 0:
+			return g_strdup_printf("0%u", v);
+		case 1:
+			return g_strdup_printf("%u.host", v);
+		case 2:
+			return g_strdup_printf("%u", G_MAXUINT32 - v % 4);
+		default:
+			return g_strdup_printf("%u", v);
+	}
+}
+
+static void test_random(void) {
+	GRand *rand = g_rand_new_with_seed(1);
+	GHashTable *ref = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	uidset_t *set = uidset_new();
+	
+	for(gint i = 0; i < 100000; i++) {
+		gchar *uid = random_uid(rand);
+		
+		if(g_rand_boolean(rand)) {
+			gboolean expected = !g_hash_table_contains(ref, uid);
+			g_assert_cmpint(uidset_add(set, uid), ==, expected);
+			g_hash_table_add(ref, g_strdup(uid));
+		} else {
+			gboolean expected = g_hash_table_contains(ref, uid);
+			g_assert_cmpint(uidset_remove(set, uid), ==, expected);
+			g_hash_table_remove(ref, uid);
+		}
+		
+		g_free(uid);
+		
+		g_assert_cmpuint(uidset_size(set), ==, g_hash_table_size(ref));
+		
+		if(i % 1000 == 0)
+			check_set(set, ref);
+		
+		if(i % 25000 == 0) {
+			uidset_clear(set);
+			g_hash_table_remove_all(ref);
+		}
+	}
+	
+	check_set(set, ref);
+	
+	uidset_free(set);
+	g_hash_table_destroy(ref);
+	g_rand_free(rand);
+}
+
+int main(int argc, char *argv[]) {
+	g_test_init(&argc, &argv, NULL);
+	
+	g_test_add_func("/uidset/parse", test_parse);
+	g_test_add_func("/uidset/runs", test_runs);
+	g_test_add_func("/uidset/random", test_random);
+	
+	return g_test_run();
+}